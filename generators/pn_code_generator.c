@@ -5,7 +5,9 @@ The method used here is described here:
 https://blog.kurttomlinson.com/posts/prbs-pseudo-random-binary-sequence
 
 It might not be the most efficient way to do this, but I understand what it
-does, and we're only going up to 10 bits for our longest sequence.
+does, and we're only going up to 10 bits for our longest sequence. Longer
+codes (up to 16 bits) are generated at runtime by src/pn_sequence.c using the
+same method, rather than being written out here.
 
 Wikipedia has a list of characteristic polynomials if at some point you want
 to add more to this generation function.
@@ -14,8 +16,10 @@ to add more to this generation function.
 Note that the +1 term in the polynomials is dropped in our binary reperesentation,
 but is used when we output the bit (using bit & 1)
 
-Also generates binary data files with possible combinations of pn_bit_len and
-allowed modulation frequencies FFT'd into the frequency domain.
+Binary data files with combinations of pn_bit_len and modulation frequency
+FFT'd into the frequency domain are not generated here, as they also depend on
+the spectrometer's wavelength calibration. The application writes them to
+cache/pn_responses the first time each combination is used (see pn_cache.c).
 
 */
 
@@ -0,0 +1,53 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for the state that's kept from one scan to the next
+#ifndef ACQ_SESSION
+#define ACQ_SESSION
+
+#include <gtk/gtk.h>
+
+#include "spectral_precision.h"
+#include "spectrometer_functions.h"
+
+// Lives as long as the program does. A running scan holds the session (see
+// acq_session_hold), and while it does the spectrometer can't be switched, so
+// the device and PN responses the scan points to stay valid. Scans on
+// different spectrometers each need their own session.
+struct acqSession {
+  struct spectrometer *spectrometer; // The one the axis is for, NULL if none yet
+  int numPixels;
+  double *wavelengths; // numPixels, straight from the spectrometer calibration
+  spec_real *frequencies; // numPixels, in cm^-1
+  int integrationTime; // Last one sent to the spectrometer (ms), 0 if none
+  GHashTable *pn_responses; // struct pnCacheKey -> PN response, for this axis
+  GMutex lock; // For scans, and held while the spectrometer is switched
+  int scans; // How many scans hold the session
+};
+
+struct acqSession *acq_session_new();
+void acq_session_free(struct acqSession *session);
+int acq_session_use_spectrometer(struct acqSession *session,
+                                 long spectrometerId); // returns numPixels, -1 if held
+void acq_session_hold(struct acqSession *session);
+void acq_session_release(struct acqSession *session);
+void acq_session_set_integration_time(struct acqSession *session,
+                                      int integrationTime); // in ms
+const spec_real *acq_session_pn_response(struct acqSession *session,
+                                         int pn_bit_len,
+                                         int mod_freq, // in MHz
+                                         unsigned long int samps_per_bit); // NULL if it failed
+
+#endif
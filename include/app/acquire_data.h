@@ -17,18 +17,34 @@
 #ifndef ACQUIRE_DATA
 #define ACQUIRE_DATA
 
+#include "spectral_precision.h"
+#include "spectrometer_functions.h"
+
 struct dataAcqParams {
+  struct acqSession *session; // Devices and settings kept between scans
   long spectrometerId;
-  int integrationTime; // in ms
-  int measurement_reps; // in #
+  int integrationTime; // in ms, the most auto exposure will choose
+  int auto_exposure; // Pick integrationTime from probe spectra before the scan
+  int measurement_reps; // in #, the most we'll do with a target_snr
+  double target_snr; // Stop once the SNR band reaches this, 0 for off
+  double snr_band_low; // in cm^-1, Raman shifts the SNR is summed over
+  double snr_band_high;
+  double roi_low; // in cm^-1, only pixels from roi_low to roi_high are kept
+  double roi_high; // 0 to keep the whole spectrum
+  int roi_first; // Those pixels, worked out by data_acq from the axis
+  int roi_count;
   int mod_freq; // in MHz
   int pn_bit_length; // Length of pn code
+  unsigned long int pn_samps_per_bit; // Oversampling used for the PN spectrum
   struct dataOutputOpts *outputPtr;
   GtkWidget *progressBar;
   int timeoutID;
   int timeoutInterval;
+  int timeoutLoops; // How many times the progress bar has been updated
   GtkWidget *scan_btn; // Start/Stop button
-  GCancellable *cancellable;
+  GCancellable *cancellable; // A reference of its own, dropped when the scan is freed
+  gint64 openTime; // How long setting up the spectrometer took (us)
+  gint dutyPermille; // Live duty cycle for the progress bar, -1 before the first spectrum
 };
 
 void start_data_acq_async(gpointer            data,
@@ -36,5 +52,11 @@ void start_data_acq_async(gpointer            data,
                           GAsyncReadyCallback callback,
                           gpointer            user_data);
 int progressBar_timeout_cb(gpointer data);
+int wait_for_spectra(struct spectrometer *spec,
+                     GCancellable *cancellable,
+                     gulong pollInterval); // in us
+void calc_raman_shifts(int numPixels,
+                       const double wavelengths[], // in nm
+                       spec_real frequencies[]); // output, in cm^-1
 
 #endif
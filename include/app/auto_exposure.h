@@ -0,0 +1,32 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for choosing the integration time before a scan
+#ifndef AUTO_EXPOSURE
+#define AUTO_EXPOSURE
+
+#include <gtk/gtk.h>
+
+#include "acq_session.h"
+
+// Returns the integration time chosen (ms)
+int auto_exposure(struct acqSession *session,
+                  int first, // Only pixels first to first + count - 1 are looked at
+                  int count,
+                  int maxTime, // ms
+                  GCancellable *cancellable,
+                  spec_real probe[]); // Working space, spectrometer's numPixels long
+
+#endif
@@ -0,0 +1,40 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for co-adding repetitions of a spectrum
+#ifndef COADD
+#define COADD
+
+#include "spectral_precision.h"
+
+// Running per pixel mean and variance (Welford's algorithm). Always double,
+// so long runs don't lose precision whatever spec_real is.
+struct coaddStats {
+  int numPixels;
+  int count; // Spectra added so far
+  double *mean; // numPixels
+  double *m2; // numPixels, sum of squared differences from the mean
+};
+
+void coadd_init(struct coaddStats *stats,
+                int numPixels,
+                double mean[], // numPixels, owned by caller
+                double m2[]); // numPixels, owned by caller
+void coadd_add(struct coaddStats *stats, const spec_real values[]);
+double coadd_std(const struct coaddStats *stats, int pixel);
+double coadd_band_snr(const struct coaddStats *stats,
+                      int first, int last); // pixels first to last - 1
+
+#endif
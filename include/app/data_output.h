@@ -17,21 +17,34 @@
 #define DATA_OUTPUT
 
 #include "acquire_data.h"
+#include "spectral_precision.h"
 
 // Note: check the state using (e.g.): if (dataCheckboxes->raw_data) {}
 struct dataOutputOpts {
   int raw_data;
   int pn_fft_data;
   int final_data;
+  int coadd; // One mean / standard deviation file instead of raw and final per rep
+  int stream; // Run until cancelled, saving to segment files instead of per rep
   const char *fname;
   const char *data_dir;
 };
 
-void output_data(int numPixels,
-                 double wavelengths[],
-                 double pixelValues[],
-                 double pn_interp_fft[],
-                 int iteration,
-                 struct dataAcqParams *params);
+struct scanContext;
+
+void output_data(struct scanContext *scan,
+                 spec_real pixelValues[],
+                 int iteration);
+void output_coadd(struct scanContext *scan);
+void output_summary(struct scanContext *scan, const gchar *report);
+void output_stream(struct scanContext *scan,
+                   spec_real pixelValues[],
+                   int iteration,
+                   gint64 timestamp); // monotonic, in us
+void close_stream(struct scanContext *scan);
+void output_timestamp(struct scanContext *scan,
+                      int iteration,
+                      gint64 timestamp);
+void close_timestamps(struct scanContext *scan);
 
 #endif
@@ -17,21 +17,79 @@
 #ifndef FFT_FUNCTIONS
 #define FFT_FUNCTIONS
 
+#include "spectral_precision.h"
+
+// Methods for building the spectrum of the PN code (see PN_FFT_METHOD in
+// measurement_params.h)
+#define PN_FFT_OVERSAMPLED 0 // FFT of the code sampled samps_per_bit times per bit
+#define PN_FFT_ANALYTIC    1 // FFT of the bare bits times the envelope of one bit
+#define PN_FFT_DIRECT      2 // Transform of the bits at the spectrometer frequencies
+
+void fft_plans_init(const char *wisdom_path);
+void fft_plans_shutdown();
+
 void interpolate_fft_data(int numPixels, // in spectrometer
-                          double spec_freqs[],
+                          spec_real spec_freqs[],
                           unsigned long int fft_length,
-                          double fft_freqs[],
-                          double fft_pows[],
-                          double fft_interp[]); // output, length of numPixels
+                          spec_real fft_freqs[],
+                          spec_real fft_pows[],
+                          spec_real fft_interp[]); // output, length of numPixels
+
+void interpolate_fft_data_scan(int numPixels, // Any fft_freqs
+                               spec_real spec_freqs[],
+                               unsigned long int fft_length,
+                               spec_real fft_freqs[],
+                               spec_real fft_pows[],
+                               spec_real fft_interp[]);
+
+void interpolate_uniform_fft_data(int numPixels, // Evenly spaced fft_freqs
+                                  spec_real spec_freqs[],
+                                  unsigned long int fft_length,
+                                  double f0,
+                                  double df,
+                                  spec_real fft_pows[],
+                                  spec_real fft_interp[]);
+
+unsigned long int calc_fft_length(int pn_bit_len,
+                                  unsigned long int samps_per_bit);
+double pn_fft_spacing(int mod_freq, // of the generated axis, which starts at 0
+                      int pn_bit_len);
+
+
+// Both return 0, or -1 (with zeros in the output) if the FFT can't be done
+int generate_pn_fft(int mod_freq,
+                    int pn_bit_len,
+                    unsigned long int samps_per_bit,
+                    int pn_bits[], // pn_bit_len long
+                    unsigned long int fft_len,
+                    spec_real pn_fft_freq[],
+                    spec_real pn_fft_pow[]);
 
-unsigned long int calc_fft_length(int pn_bit_len);
+int generate_pn_fft_analytic(int mod_freq,
+                             int pn_bit_len,
+                             unsigned long int samps_per_bit,
+                             int pn_bits[], // pn_bit_len long
+                             unsigned long int fft_len,
+                             spec_real pn_fft_freq[],
+                             spec_real pn_fft_pow[]);
 
+void evaluate_pn_spectrum(int mod_freq,
+                          int pn_bit_len,
+                          unsigned long int samps_per_bit,
+                          int pn_bits[], // pn_bit_len long
+                          int numPixels,
+                          spec_real spec_freqs[],
+                          spec_real pn_interp[]); // output, length of numPixels
 
-void generate_pn_fft(int mod_freq,
-                     int pn_bit_len,
-                     int pn_bits[1024],
-                     unsigned long int fft_len,
-                     double pn_fft_freq[],
-                     double pn_fft_pow[]);
+int interpolate_cached_pn_fft(int method, // returns 0, or -1 if the FFT failed
+                              int mod_freq,
+                              int pn_bit_len,
+                              unsigned long int samps_per_bit,
+                              int pn_bits[], // pn_bit_len long
+                              int numPixels,
+                              spec_real spec_freqs[],
+                              spec_real pn_interp[]); // output, length of numPixels
+void forget_cached_pn_fft(int pn_bit_len);
+void clear_pn_fft_cache();
 
 #endif
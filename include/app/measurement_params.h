@@ -19,19 +19,78 @@
 #define MEASUREMENT_PARAMS
 
 #define MODULATION_OPTS     3      // Number of choices for modulation frequency
-#define PN_CODE_LENGTH_OPTS 6
+#define PN_CODE_LENGTH_OPTS 12
 #define LASER_WAVELENGTH 638.318 // in nm
 
+// How the spectrum of the PN code is computed, options are in fft_functions.h
+// PN_FFT_OVERSAMPLED and PN_FFT_ANALYTIC give the same result (the latter is
+// much cheaper) which is then interpolated onto the spectrometer. PN_FFT_DIRECT
+// evaluates the code's continuous transform at each pixel instead, which isn't
+// the same thing between FFT points (pn_interp_check shows by how much), so
+// it changes the Finalized and PN FFT data.
+#define PN_FFT_METHOD PN_FFT_ANALYTIC
+
+// Number of samples per bit used to model the PN code. Keep as a power of 2 to
+// make the FFT fast. Run pn_report to see the accuracy and cost of other values.
+#define PN_SAMPS_PER_BIT 512
+
+// Spectra waiting to be written out while the spectrometer keeps measuring.
+// The spectrometer only waits on the output if this many are backed up.
+#define SPECTRUM_RING_SLOTS 16
+
+// Read spectra from the spectrometer's on-board buffer as fast as it fills it
+// (1), instead of clearing it and waiting for a fresh one each repetition (0).
+// Burst readout keeps up to SPECTROMETER_BUFFER_SPECTRA queued on the device.
+#define BURST_READOUT 1
+#define SPECTROMETER_BUFFER_SPECTRA 1000
+
+// Longest time (in ms) between checks for a new spectrum, this is also about
+// the longest it takes Stop Scan to take effect
+#define ACQ_POLL_INTERVAL_MAX 20
+
+// When streaming, each segment file holds this many spectra (one per line)
+// before the next file is started. If STREAM_KEEP_SEGMENTS isn't 0, only that
+// many of the most recent segments are kept on disk.
+#define STREAM_SEGMENT_SPECTRA 1000
+#define STREAM_KEEP_SEGMENTS 0
+
+// When co-adding repetitions, rewrite the mean / standard deviation file every
+// this many repetitions so a long run can be checked (or survives a crash).
+// 0 only writes it at the end.
+#define COADD_CHECKPOINT_REPS 100
+
+// With a target SNR set, a scan stops early once the summed signal over the
+// SNR band chosen in the window is at least that many times its standard
+// error. Checked from SNR_MIN_REPS repetitions on, as the noise estimate from
+// fewer isn't worth much.
+#define SNR_MIN_REPS 3
+
+// Auto exposure starts with an AUTO_EXPOSURE_FIRST_PROBE ms spectrum and aims
+// for the brightest pixel to be AUTO_EXPOSURE_TARGET of full scale, in at most
+// AUTO_EXPOSURE_MAX_PROBES spectra. It's done once a probe predicts a time
+// within AUTO_EXPOSURE_TOLERANCE of its own. A probe with any pixel at
+// AUTO_EXPOSURE_SATURATED of full scale or more is saturated, and the next is
+// AUTO_EXPOSURE_BACKOFF times shorter.
+#define AUTO_EXPOSURE_TARGET 0.8
+#define AUTO_EXPOSURE_FIRST_PROBE 10 // ms
+#define AUTO_EXPOSURE_MAX_PROBES 6
+#define AUTO_EXPOSURE_TOLERANCE 0.05
+#define AUTO_EXPOSURE_SATURATED 0.98
+#define AUTO_EXPOSURE_BACKOFF 4
+
 // Parameters for electro-optic modulator
 #define WVFM_MAGNITUDE 850 // Dependent on your waveform generator and/or amplifier
                            // Ours accepts values 0-4095, but with the amplifier
                            // we need only a fraction of that (850 into 50 Ohms)
+#define WVFM_MAX_POINTS 8388608 // Sample memory of our DAx22000 (8M version)
 
 
 static const int mod_freqs[MODULATION_OPTS] = {100, 250, 500}; // In MHz
-static const int pn_code_lengths[PN_CODE_LENGTH_OPTS] = {32, 64, 128, 256, 512, 1024};
-// If you change pn_code_lengths, you will also need to update pn_code_generator.c
-// and waveform_gen.c to use the new values. This is only necessary if you add
-// or alter values, if you remove them it should still be fine.
+static const int pn_code_lengths[PN_CODE_LENGTH_OPTS] = {32, 64, 128, 256, 512, 1024,
+  2048, 4096, 8192, 16384, 32768, 65536};
+// If you change pn_code_lengths, you will also need to update pn_sequence.c
+// (and pn_code_generator.c for codes up to 1024 bits) to use the new values.
+// This is only necessary if you add or alter values, if you remove them it
+// should still be fine. Each entry must be twice the one before it.
 
 #endif
@@ -0,0 +1,41 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for the on-disk cache of PN responses at the spectrometer pixels
+#ifndef PN_CACHE
+#define PN_CACHE
+
+#include "spectral_precision.h"
+
+#define PN_CACHE_DIR "../cache/pn_responses" // Relative to bin/, like the glade and css files
+
+// Everything the interpolated PN response depends on
+struct pnCacheKey {
+  int pn_bit_len;
+  int mod_freq; // in MHz
+  int method; // PN_FFT_METHOD used to compute it
+  int numPixels;
+  unsigned long int samps_per_bit; // oversampling of the PN code
+  guint64 axis_hash; // from pn_cache_hash_axis()
+};
+
+gchar *pn_cache_filename(const struct pnCacheKey *key); // g_free when done
+guint64 pn_cache_hash_axis(int numPixels, const spec_real axis[]);
+GMappedFile *pn_cache_load(const struct pnCacheKey *key,
+                           const spec_real **values); // set to the cached data
+void pn_cache_store(const struct pnCacheKey *key,
+                    const spec_real values[]); // numPixels long
+
+#endif
@@ -0,0 +1,37 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for computing PN responses, ahead of time or on demand
+#ifndef PN_PRECOMPUTE
+#define PN_PRECOMPUTE
+
+#include "pn_cache.h"
+#include "spectral_precision.h"
+
+int pn_response_compute(const struct pnCacheKey *key, // returns 0, -1 if it failed
+                        spec_real spec_freqs[], // key->numPixels long
+                        spec_real pn_interp[]); // output, key->numPixels long
+
+void pn_precompute_start(int numPixels,
+                         const spec_real spec_freqs[],
+                         unsigned long int samps_per_bit);
+void pn_precompute_stop();
+
+spec_real *pn_response_acquire(const struct pnCacheKey *key, // NULL if it failed
+                               spec_real spec_freqs[], // key->numPixels long
+                               spec_real buf[], // used if computed here
+                               GMappedFile **mapped); // set if from the disk cache
+
+#endif
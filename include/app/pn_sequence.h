@@ -0,0 +1,24 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for looking up the bits of a PN code
+#ifndef PN_SEQUENCE
+#define PN_SEQUENCE
+
+#define MAX_PN_BIT_LEN 65536 // Longest code we know the polynomial for
+
+int *get_pn_bits(int pn_bit_len); // g_free() the result, NULL if unsupported
+
+#endif
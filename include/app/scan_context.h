@@ -0,0 +1,100 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for the buffers and settings that live for one scan
+#ifndef SCAN_CONTEXT
+#define SCAN_CONTEXT
+
+#include <gtk/gtk.h>
+
+#include "acq_session.h"
+#include "acquire_data.h"
+#include "coadd.h"
+#include "spectral_precision.h"
+#include "spectrometer_functions.h"
+#include "spectrum_ring.h"
+#include "stage_timing.h"
+
+#define SCAN_ARENA_ALIGN 64 // Cache line, and enough for any vector loads
+
+// The scan and its own buffers are carved out of one block, sized from the
+// pixel count when the scan starts, so the repetitions don't need any more of
+// them. Opening files and printing still allocate inside stdio/GLib, so
+// scan_heap_report() measures the heap over the repetitions.
+struct scanContext {
+  guint8 *arena_block; // As allocated, the scan is at the start of it
+  guint8 *arena; // Buffers go here, after the scan, aligned to SCAN_ARENA_ALIGN
+  gsize arena_size;
+  gsize arena_used;
+  int arena_allocs; // Buffers handed out by scan_alloc()
+  gint64 heap_before; // Heap in use when the repetitions started, -1 if unknown
+
+  int numPixels; // In the region of interest, all that's processed or saved
+  int roi_first; // Index of the first of those in a whole spectrum
+  int spectrumPixels; // Whole spectrum, as read from the spectrometer
+  struct dataAcqParams *params;
+  struct spectrometer *spectrometer; // Owned by the session
+  struct darkHistory dark; // Only used by the output thread
+  // Both start at roi_first, and are owned by the session
+  const spec_real *frequencies; // numPixels, in cm^-1
+  const spec_real *pn_interp_fft; // numPixels, the PN response
+  spec_real *probe; // spectrumPixels, for auto exposure (only if it's on)
+  struct spectrumRing ring; // Spectra waiting for the output thread
+  struct coaddStats coadd; // Only set up if outputPtr->coadd or params->target_snr
+  int snr_first; // Pixels in the SNR band are snr_first to snr_last - 1
+  int snr_last;
+  int target_reached; // Set (atomically) by the output thread, ends the scan
+  struct stageTimings timing; // How long each part of the scan took
+
+  // Output files, built once. Per repetition files are prefix + rep + ".txt",
+  // written into path_buf (only used by the output thread).
+  gchar *header; // Settings, the first line of every file
+  gsize header_len; // Room for the header, with any integration time
+  gchar *raw_prefix;
+  gchar *final_prefix;
+  gchar *pn_fft_path;
+  gchar *coadd_path;
+  gchar *summary_path;
+  gchar *timestamps_path;
+  gchar *stream_prefix;
+  gchar *path_buf;
+  gsize path_buf_len;
+
+  // Streaming, only touched by the output thread
+  FILE *segment_file; // The only one open at a time
+  int segment_index;
+  int segment_spectra; // Written to segment_file (or dropped, if it failed) so far
+  int segment_failed; // The current segment couldn't be opened
+  FILE *timestamps_file; // When each repetition was taken, if not streaming
+  int timestamps_failed; // Couldn't open it, so it isn't tried again
+  gint64 start_time; // Monotonic (us), timestamps are relative to this
+  struct cadenceStats cadence; // Time between spectra, only used by data_acq without burst readout
+};
+
+void find_roi(int numPixels,
+              const spec_real frequencies[], // in cm^-1
+              double low,
+              double high, // 0 for the whole spectrum
+              int *first, // output
+              int *count); // output
+struct scanContext *scan_context_new(struct acqSession *session,
+                                     struct dataAcqParams *params);
+void scan_context_set_header(struct scanContext *scan);
+void *scan_alloc(struct scanContext *scan, gsize size);
+void scan_context_seal(struct scanContext *scan);
+gchar *scan_heap_report(const struct scanContext *scan); // g_free when done
+void scan_context_free(struct scanContext *scan);
+
+#endif
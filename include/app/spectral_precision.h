@@ -0,0 +1,37 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Floating point type for spectra, frequency axes and the PN response. Set
+// with the SINGLE_PRECISION CMake option, which also links the float version
+// of FFTW. Device calibration data (wavelengths, nonlinearity coefficients)
+// and running sums stay in double either way.
+#ifndef SPECTRAL_PRECISION
+#define SPECTRAL_PRECISION
+
+#include <float.h>
+
+#ifdef USE_SINGLE_PRECISION
+typedef float spec_real;
+#define SPEC_REAL_EPSILON FLT_EPSILON
+#define FFTW(name) fftwf_ ## name // Only usable after including fftw3.h
+#define FFTW_WISDOM_FILE "../cache/fftwf_wisdom.dat"
+#else
+typedef double spec_real;
+#define SPEC_REAL_EPSILON DBL_EPSILON
+#define FFTW(name) fftw_ ## name
+#define FFTW_WISDOM_FILE "../cache/fftw_wisdom.dat"
+#endif
+
+#endif
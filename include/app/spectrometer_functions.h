@@ -13,24 +13,70 @@
     along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
 **/
 
-#ifndef SPECTROMTER_FUNCS
+#ifndef SPECTROMETER_FUNCS
 #define SPECTROMETER_FUNCS
 
+#include "spectral_precision.h"
+
 #define MAX_SPECTROMETERS 10 // maximum number of spectrometers you might connect at once
 #define MAX_SPEC_NAME_LEN 80 // number of characters in longest name allowed
 
+// These values are for electronic dark and nonlinearity correction:
+#define MAX_DARK_PIXELS 32
+#define DARK_PIXEL_BUF_SIZE 40 // Number of recent dark pixel results to store / average
+#define MAX_NL_COEFFS 10
+
+// An open spectrometer, from open_spectrometer()
+struct spectrometer {
+  long deviceId;
+  long specId; // WE ARE ASSUMING ONLY ONE
+  long bufferId; // and only one data buffer
+  int numPixels;
+  double max_intensity; // Full scale, in counts
+  long min_integration_us;
+  long max_integration_us; // 0 if the spectrometer doesn't say
+  int dark_pixel_count;
+  int dark_pixels[MAX_DARK_PIXELS];
+  int num_nl_coeffs;
+  double nl_coeffs[MAX_NL_COEFFS];
+#ifdef USE_SINGLE_PRECISION
+  double *raw_spectrum; // numPixels, SeaBreeze only returns doubles
+#endif
+};
+
+// Recent electric dark pixel values, averaged for the baseline. Each scan has
+// its own so nothing carries over from the last one.
+struct darkHistory {
+  double values[DARK_PIXEL_BUF_SIZE];
+  int pos;
+  int full;
+};
+
 void initialize_spectrometer_api();
 int count_spectrometers();
 int get_spectrometer_ids(long idArr[MAX_SPECTROMETERS],
                          int count);
 void get_spectrometer_name(long deviceId, char nameBuf[MAX_SPEC_NAME_LEN]);
 void shutdown_spectrometer_api();
-void open_spectrometer(long spectrometerId);
-void close_spectrometer();
-void set_integration_time(int integrationTime);
-void clear_spectrometer_buffer();
-int get_spectrum(double values[]);
-int count_spectrometer_pixels();
-void get_wavelengths(double wavelengths[]);
+struct spectrometer *open_spectrometer(long spectrometerId);
+void close_spectrometer(struct spectrometer *spec);
+void set_integration_time(struct spectrometer *spec, int integrationTime);
+void clear_spectrometer_buffer(struct spectrometer *spec);
+int get_spectrum(struct spectrometer *spec, struct darkHistory *history,
+                 spec_real values[]); // read_spectrum() then correct_spectrum()
+int read_spectrum(struct spectrometer *spec, spec_real values[]);
+void correct_spectrum(const struct spectrometer *spec, struct darkHistory *history,
+                      spec_real values[]); // do_edark_correction() then do_nonlinearity_correction()
+void dark_history_reset(struct darkHistory *history);
+// Both correct pixels first to last - 1 of values (a whole spectrum)
+void do_edark_correction(const struct spectrometer *spec, struct darkHistory *history,
+                         spec_real values[], int first, int last);
+void do_nonlinearity_correction(const struct spectrometer *spec, spec_real values[],
+                                int first, int last);
+unsigned long int start_burst_readout(struct spectrometer *spec,
+                                      unsigned long int capacity);
+int count_buffered_spectra(struct spectrometer *spec);
+int count_spectrometer_pixels(const struct spectrometer *spec);
+void get_wavelengths(const struct spectrometer *spec, double wavelengths[]);
 
 #endif
@@ -0,0 +1,60 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for the ring of spectra passed from acquisition to output
+#ifndef SPECTRUM_RING
+#define SPECTRUM_RING
+
+#include <gtk/gtk.h>
+
+#include "spectral_precision.h"
+
+// Single producer, single consumer. Slots are claimed and released with atomic
+// counters, the lock and condition are only used to sleep when the ring is
+// full (producer) or empty (consumer).
+struct spectrumRing {
+  int numSlots;
+  int numPixels;
+  spec_real *slots; // numSlots * numPixels
+  int *iterations; // Repetition each slot holds
+  gint64 *timestamps; // When each slot's spectrum was acquired (monotonic, us)
+  gint head; // Slots written so far, only changed by the producer
+  gint tail; // Slots read so far, only changed by the consumer
+  gint closed; // Producer is done
+  gint producer_waiting; // (About to be) asleep on changed because it's full
+  gint consumer_waiting; // (About to be) asleep on changed because it's empty
+  GMutex lock;
+  GCond changed;
+};
+
+void spectrum_ring_init(struct spectrumRing *ring,
+                        int numSlots,
+                        int numPixels,
+                        spec_real slots[], // numSlots * numPixels, owned by caller
+                        int iterations[], // numSlots, owned by caller
+                        gint64 timestamps[]); // numSlots, owned by caller
+void spectrum_ring_clear(struct spectrumRing *ring);
+
+spec_real *spectrum_ring_begin_write(struct spectrumRing *ring); // waits while full
+void spectrum_ring_end_write(struct spectrumRing *ring, int iteration,
+                             gint64 timestamp);
+void spectrum_ring_close(struct spectrumRing *ring);
+
+spec_real *spectrum_ring_begin_read(struct spectrumRing *ring, // waits while empty,
+                                    int *iteration, // NULL once closed and empty
+                                    gint64 *timestamp);
+void spectrum_ring_end_read(struct spectrumRing *ring);
+
+#endif
@@ -0,0 +1,74 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Header file for timing the stages of a scan
+#ifndef STAGE_TIMING
+#define STAGE_TIMING
+
+#include <gtk/gtk.h>
+
+// Stages of data_acq that get timed
+#define STAGE_OPEN_SPECTROMETER 0 // Including its wavenumber axis
+#define STAGE_AUTO_EXPOSURE     1
+#define STAGE_PN_RESPONSE       2
+#define STAGE_CLEAR_BUFFER      3
+#define STAGE_WAIT_SPECTRUM     4
+#define STAGE_READ_SPECTRUM     5
+#define STAGE_EDARK             6
+#define STAGE_NONLINEARITY      7
+#define STAGE_OUTPUT            8
+#define NUM_STAGES              9
+
+// Log-linear buckets in microseconds: exact below STAGE_SUB_BUCKETS, then
+// STAGE_SUB_BUCKETS per power of two (about 12% wide), up to over an hour
+#define STAGE_SUB_BUCKETS 8
+#define STAGE_BUCKETS (32 * STAGE_SUB_BUCKETS)
+
+struct stageHistogram {
+  guint32 buckets[STAGE_BUCKETS];
+  guint64 count;
+  gint64 total; // in us
+  gint64 max; // in us
+};
+
+// Time between consecutive spectra (running mean and variance, in us), and
+// how many came late
+struct cadenceStats {
+  guint64 count; // Intervals so far, one less than the spectra
+  double mean;
+  double m2; // Sum of squared differences from the mean
+  gint64 max;
+  int late;
+  gint64 last; // Timestamp of the previous spectrum, 0 before the first
+};
+
+// Each stage must only be recorded from one thread
+struct stageTimings {
+  struct stageHistogram stages[NUM_STAGES];
+};
+
+void stage_timings_reset(struct stageTimings *timings);
+void stage_add(struct stageTimings *timings, int stage, gint64 elapsed);
+void stage_record(struct stageTimings *timings, int stage, gint64 start);
+void stage_timings_print(const struct stageTimings *timings);
+void cadence_reset(struct cadenceStats *stats);
+gint64 cadence_add(struct cadenceStats *stats, gint64 timestamp,
+                   gint64 late_after); // returns the interval, 0 for the first
+gchar *cadence_report(const struct cadenceStats *stats); // g_free when done
+double duty_cycle(int spectra, int integrationTime, gint64 elapsed);
+gchar *duty_cycle_report(const struct stageTimings *timings, int spectra,
+                         int integrationTime, gint64 elapsed); // g_free when done
+
+#endif
@@ -17,8 +17,9 @@
 #ifndef WAVEFORM_CONSTANTS
 #define WAVEFORM_CONSTANTS
 
-void start_wvfm_gen(int pn_bit_len, int mod_freq);
+int start_wvfm_gen(int pn_bit_len, int mod_freq); // 0 if running, -1 if not
 void stop_wvfm_gen();
+void close_wvfm_gen();
 unsigned long count_wvfm_gen();
 
 #endif
@@ -0,0 +1,174 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Everything that can carry over from one scan to the next: the open
+// spectrometer, its wavenumber axis, the integration time it's set to and the
+// PN responses already worked out for that axis. Each is only redone when a
+// setting it depends on changes, so repeating a scan starts straight away.
+// (The waveform generator keeps its own state in waveform_gen.c.)
+
+#include <gtk/gtk.h>
+
+#include "acq_session.h"
+#include "acquire_data.h"
+#include "fft_functions.h"
+#include "measurement_params.h"
+#include "pn_cache.h"
+#include "pn_precompute.h"
+#include "spectrometer_functions.h"
+
+// One PN response, values points into buf or mapped
+struct pnResponse {
+  spec_real *values;
+  spec_real *buf;
+  GMappedFile *mapped;
+};
+
+void pn_response_free(gpointer data)
+{
+  struct pnResponse *response = data;
+  if (response->mapped) {
+    g_mapped_file_unref(response->mapped);
+  }
+  g_free(response->buf);
+  g_free(response);
+}
+
+struct acqSession *acq_session_new()
+{
+  struct acqSession *session = g_malloc0(sizeof(*session));
+  // Keyed by the cache file name, which covers every setting the response
+  // depends on
+  session->pn_responses = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, pn_response_free);
+  g_mutex_init(&session->lock);
+  return session;
+}
+
+void acq_session_free(struct acqSession *session)
+{
+  g_hash_table_destroy(session->pn_responses);
+  if (session->spectrometer) {
+    close_spectrometer(session->spectrometer);
+  }
+  g_free(session->wavelengths);
+  g_free(session->frequencies);
+  g_mutex_clear(&session->lock);
+  g_free(session);
+}
+
+// A scan holds the session from before it first touches the spectrometer
+// until it's freed, so nothing it points to is closed or unmapped under it
+void acq_session_hold(struct acqSession *session)
+{
+  g_mutex_lock(&session->lock);
+  session->scans++;
+  g_mutex_unlock(&session->lock);
+}
+
+void acq_session_release(struct acqSession *session)
+{
+  g_mutex_lock(&session->lock);
+  session->scans--;
+  g_mutex_unlock(&session->lock);
+}
+
+// Open spectrometerId (if it isn't already) and make sure the axis is for it.
+// Switching spectrometers closes the old one and drops everything worked out
+// for it, so it's refused (returning -1) while a scan holds the session.
+int acq_session_use_spectrometer(struct acqSession *session,
+                                 long spectrometerId)
+{
+  if (session->spectrometer && session->spectrometer->deviceId == spectrometerId) {
+    return session->numPixels;
+  }
+
+  g_mutex_lock(&session->lock);
+  if (session->scans > 0) {
+    g_mutex_unlock(&session->lock);
+    g_print("Can't switch spectrometers while a scan is using one\n");
+    return -1;
+  }
+
+  g_hash_table_remove_all(session->pn_responses);
+  g_free(session->wavelengths);
+  g_free(session->frequencies);
+  if (session->spectrometer) {
+    close_spectrometer(session->spectrometer);
+  }
+
+  session->spectrometer = open_spectrometer(spectrometerId);
+  session->numPixels = count_spectrometer_pixels(session->spectrometer);
+  session->wavelengths = g_malloc0(session->numPixels * sizeof(*session->wavelengths));
+  session->frequencies = g_malloc0(session->numPixels * sizeof(*session->frequencies));
+  get_wavelengths(session->spectrometer, session->wavelengths);
+  calc_raman_shifts(session->numPixels, session->wavelengths, session->frequencies);
+
+  session->integrationTime = 0; // Don't know what the new one is set to
+  g_mutex_unlock(&session->lock);
+  return session->numPixels;
+}
+
+void acq_session_set_integration_time(struct acqSession *session,
+                                      int integrationTime)
+{
+  if (integrationTime != session->integrationTime) {
+    set_integration_time(session->spectrometer, integrationTime);
+    session->integrationTime = integrationTime;
+  }
+}
+
+// The PN response for these settings on the current spectrometer's axis.
+// Looked up (or computed) the first time and kept until the spectrometer
+// changes, so it stays valid until then. NULL if it couldn't be computed, which
+// isn't kept, so the next scan tries again.
+const spec_real *acq_session_pn_response(struct acqSession *session,
+                                         int pn_bit_len,
+                                         int mod_freq,
+                                         unsigned long int samps_per_bit)
+{
+  struct pnCacheKey key;
+  key.pn_bit_len = pn_bit_len;
+  key.mod_freq = mod_freq;
+  key.method = PN_FFT_METHOD;
+  key.numPixels = session->numPixels;
+  key.samps_per_bit = samps_per_bit;
+  key.axis_hash = pn_cache_hash_axis(session->numPixels, session->frequencies);
+
+  gchar *name = pn_cache_filename(&key);
+  struct pnResponse *response = g_hash_table_lookup(session->pn_responses, name);
+  if (response) {
+    g_free(name);
+    return response->values;
+  }
+
+  // Usually done in the background at startup, if not it's computed here
+  response = g_malloc0(sizeof(*response));
+  response->buf = g_malloc0(session->numPixels * sizeof(*response->buf));
+  response->values = pn_response_acquire(&key, session->frequencies,
+                                         response->buf, &response->mapped);
+  if (response->values == NULL) {
+    pn_response_free(response);
+    g_free(name);
+    return NULL;
+  }
+  if (response->mapped) {
+    // Don't need the buffer after all
+    g_free(response->buf);
+    response->buf = NULL;
+  }
+  g_hash_table_insert(session->pn_responses, name, response);
+  return response->values;
+}
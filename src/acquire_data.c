@@ -34,12 +34,9 @@ as needed (automatically naming files for multiple runs)
 #include "waveform_gen.h"
 #include "spectrometer_functions.h"
 #include "measurement_params.h"
-
-// PN code header:
-#include "pn_code.h"
-
-
-int timeoutLoops = 1; // global to track how many loops we've done for the progress bar
+#include "scan_context.h"
+#include "acq_session.h"
+#include "auto_exposure.h"
 
 
 // Function to update the progress bar to a given fraction of fullness:
@@ -49,21 +46,25 @@ void update_progressBar(GtkWidget *progressBar,
   gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progressBar), fraction);
 }
 
-int complete_progressBar(gpointer data)
+// Called on the main thread once a scan is over, however it ended. Nothing
+// else is using params by now, so this frees it and lets the next scan start.
+void complete_progressBar(struct dataAcqParams *params,
+                          int finished) // 0 if stopped early or failed
 {
 g_print("Inside complete_progressBar...\n");
-  struct dataAcqParams *params = data;
   GtkWidget *progressBar;
   progressBar = params->progressBar;
   g_source_remove(params->timeoutID); // This turns off our progress bar updates
-  update_progressBar(progressBar, 1.0);
+  if (finished) {
+    update_progressBar(progressBar, 1.0);
+  }
   const char *text = "Start Scan";
   gtk_button_set_label(GTK_BUTTON(params->scan_btn), text);
-  timeoutLoops = 1;
+  gtk_widget_set_sensitive(params->scan_btn, TRUE);
 
+  g_object_unref(params->cancellable);
   g_free(params->outputPtr);
   g_free(params);
-  return G_SOURCE_REMOVE;
 }
 
 int progressBar_timeout_cb(gpointer data)
@@ -75,11 +76,25 @@ int progressBar_timeout_cb(gpointer data)
   int integrationTime = params->integrationTime;
   int measurement_reps = params->measurement_reps;
   int timeoutInterval = params->timeoutInterval;
-  int timeElapsed = timeoutLoops*timeoutInterval;
+  int timeElapsed = params->timeoutLoops*timeoutInterval;
 
   GtkWidget *progressBar;
   progressBar = params->progressBar;
 
+  // Show how much of the time the detector is actually integrating:
+  int dutyPermille = g_atomic_int_get(&params->dutyPermille);
+  if (dutyPermille >= 0) {
+    gchar text[32];
+    g_snprintf(text, sizeof(text), "Duty cycle %.1f%%", dutyPermille / 10.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progressBar), text);
+  }
+
+  if (params->outputPtr->stream) {
+    // No end in sight, just show that it's running
+    gtk_progress_bar_pulse(GTK_PROGRESS_BAR(progressBar));
+    return G_SOURCE_CONTINUE;
+  }
+
   int timePadding = integrationTime; // The first result can come back from the
   // spectrometer at most 2 integrationTimes late -- 1 for a calibration and the
   // second for the real data
@@ -88,206 +103,469 @@ int progressBar_timeout_cb(gpointer data)
   double fraction = (double ) timeElapsed / (double ) totalTime;
   update_progressBar(progressBar, fraction);
 
-  timeoutLoops++;
+  params->timeoutLoops++;
 
   return G_SOURCE_CONTINUE; // We keep calling this until we cancel it...
 }
 
 
-// We don't really use this to avoid race condition
-void free_data_acq_data(void *data)
+// Convert from nm to Raman shift (in cm^-1) from the laser line
+void calc_raman_shifts(int numPixels,
+                       const double wavelengths[],
+                       spec_real frequencies[])
 {
-  timeoutLoops = 1; // Reset our loop counter for next run
-  return;
+  int i;
+  for (i = 0; i < numPixels; i++) {
+    // Assuming wavlengths are in nm:
+    //frequencies[i] = speedC / wavelengths[numPixels - 1 - i]; // Need to reorder to be from 0 -> MaxFreq instead of the opposite
+    frequencies[i] = 1.0e7*((1.0 / LASER_WAVELENGTH) - (1.0 / wavelengths[i]));
+    // we multiply by 10^7 above to convert from nm to cm for wavenumbers
+  }
+}
+
+// Wait until the spectrometer has at least one spectrum ready, checking for
+// a cancel every pollInterval (in us). Returns how many are ready, or 0 if
+// the scan was cancelled first.
+int wait_for_spectra(struct spectrometer *spec,
+                     GCancellable *cancellable,
+                     gulong pollInterval)
+{
+  int available;
+  while ((available = count_buffered_spectra(spec)) == 0) {
+    if (g_cancellable_is_cancelled(cancellable)) {
+      return 0;
+    }
+    g_usleep(pollInterval);
+  }
+  // No buffer to watch, so just let read_spectrum block for the next one
+  return (available < 0) ? 1 : available;
+}
+
+// Tell data_acq to stop once the SNR over the band reaches the target
+void check_target_snr(struct scanContext *scan)
+{
+  double target = scan->params->target_snr;
+  if (target <= 0.0 || scan->coadd.count < SNR_MIN_REPS ||
+      g_atomic_int_get(&scan->target_reached)) {
+    return;
+  }
+
+  double snr = coadd_band_snr(&scan->coadd, scan->snr_first, scan->snr_last);
+  if (snr >= target) {
+    g_print("Reached an SNR of %.1f after %d repetitions\n", snr, scan->coadd.count);
+    g_atomic_int_set(&scan->target_reached, 1);
+  }
+}
+
+// Consumer side of the spectrum ring, runs until data_acq closes it
+gpointer output_spectra(gpointer data)
+{
+  struct scanContext *scan = data;
+  spec_real *values;
+  int iteration;
+  gint64 timestamp;
+
+  gint64 start;
+
+  while ((values = spectrum_ring_begin_read(&scan->ring, &iteration, &timestamp)) != NULL) {
+    start = g_get_monotonic_time();
+    do_edark_correction(scan->spectrometer, &scan->dark, values, scan->roi_first,
+                        scan->roi_first + scan->numPixels);
+    stage_record(&scan->timing, STAGE_EDARK, start);
+
+    start = g_get_monotonic_time();
+    do_nonlinearity_correction(scan->spectrometer, values, scan->roi_first,
+                               scan->roi_first + scan->numPixels);
+    stage_record(&scan->timing, STAGE_NONLINEARITY, start);
+
+    // Add checking for saturated pixels???
+
+    // We're now ready to process / output our data (if requested), from here
+    // on only the region of interest:
+    start = g_get_monotonic_time();
+    values += scan->roi_first;
+    output_data(scan, values, iteration);
+    if (scan->params->outputPtr->stream) {
+      output_stream(scan, values, iteration, timestamp);
+    } else {
+      output_timestamp(scan, iteration, timestamp);
+    }
+
+    if (scan->coadd.mean) {
+      coadd_add(&scan->coadd, values);
+      if (scan->params->outputPtr->coadd && COADD_CHECKPOINT_REPS > 0 &&
+          scan->coadd.count % COADD_CHECKPOINT_REPS == 0) {
+        output_coadd(scan);
+      }
+      check_target_snr(scan);
+    }
+    stage_record(&scan->timing, STAGE_OUTPUT, start);
+
+    spectrum_ring_end_read(&scan->ring);
+  }
+
+  // Save the rest of the co-added reps (including any before a cancel):
+  if (scan->params->outputPtr->coadd && scan->coadd.count > 0 &&
+      (COADD_CHECKPOINT_REPS <= 0 || scan->coadd.count % COADD_CHECKPOINT_REPS != 0)) {
+    output_coadd(scan);
+  }
+  close_stream(scan);
+  close_timestamps(scan);
+
+  return NULL;
 }
 
 int data_acq(struct dataAcqParams *data)
 {
   struct dataAcqParams *params = data;
-  int i, numPixels;
-  int integrationTime = params->integrationTime;
+  int i;
   int measurement_reps = params->measurement_reps;
-  long spectrometerId = params->spectrometerId;
+  int stream = params->outputPtr->stream; // Ignore measurement_reps, run until cancelled
   int mod_freq = params->mod_freq;
   int pn_bit_len = params->pn_bit_length;
+  unsigned long int pn_samps_per_bit = params->pn_samps_per_bit;
 
   double speedC = 2.99792458e10; // In cm/sec
-  double *wavelengths, *frequencies, *values;
 
-  // Set up initial data from the spectrometer:
-  open_spectrometer(spectrometerId); // this prepares static data as well for calibration(s)
-  numPixels = count_spectrometer_pixels(); // Find out how big our data set will be
-
-  wavelengths = g_malloc0(numPixels * sizeof(wavelengths));
-  frequencies = g_malloc0(numPixels * sizeof(frequencies));
-  values = g_malloc0(numPixels * sizeof(values));
-
-  get_wavelengths(wavelengths);
-
-  // Convert from nm to frequency shift (in Hz)
-  for (i = 0; i < numPixels; i++) {
-    // Assuming wavlengths are in nm:
-    //frequencies[i] = speedC / wavelengths[numPixels - 1 - i]; // Need to reorder to be from 0 -> MaxFreq instead of the opposite
-    frequencies[i] = 1.0e7*((1.0 / LASER_WAVELENGTH) - (1.0 / wavelengths[i]));
-    // we multiply by 10^7 above to convert from nm to cm for wavenumbers
+  // The spectrometer and PN responses can't be switched out from under us
+  // until the scan is freed
+  acq_session_hold(params->session);
+
+  // Only the region of interest is processed, or looked at by auto exposure
+  find_roi(params->session->numPixels, params->session->frequencies,
+           params->roi_low, params->roi_high, &params->roi_first, &params->roi_count);
+
+  // The spectrometer and its axis were set up by spectrometer_bring_up_cb(),
+  // so every buffer for the scan can be sized for it straight away:
+  struct scanContext *scan = scan_context_new(params->session, params);
+  stage_add(&scan->timing, STAGE_OPEN_SPECTROMETER, params->openTime);
+
+  // Pick the integration time before anything is written, so it's in the
+  // header of every file:
+  gint64 start = g_get_monotonic_time();
+  if (params->auto_exposure) {
+    params->integrationTime = auto_exposure(params->session, params->roi_first,
+                                            params->roi_count, params->integrationTime,
+                                            params->cancellable, scan->probe);
+    g_print("Auto exposure chose %d ms\n", params->integrationTime);
+    scan_context_set_header(scan);
+    stage_record(&scan->timing, STAGE_AUTO_EXPOSURE, start);
   }
-
+  int integrationTime = params->integrationTime;
 
   // Generate PN FFT data for multiplication (if needed)
-  unsigned long int fft_length;
-  double *pn_fft_freq, *pn_fft_pow,*pn_interp_fft;
-
   if (params->outputPtr->final_data || params->outputPtr->pn_fft_data) {
-    fft_length = calc_fft_length(pn_bit_len);
-    pn_fft_freq = g_malloc0(sizeof(*pn_fft_freq) * fft_length); // As long as our output
-    pn_fft_pow = g_malloc0(sizeof(*pn_fft_pow) * fft_length); // ""
-    pn_interp_fft = g_malloc0(sizeof(*pn_interp_fft) * numPixels); // Same number of elements as Pixels
-
-    // Get PN bits:
-    int pn_bits[1024] = {0};
-    if (pn_bit_len == 32) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_32_bit[i];
-      }
-    } else if (pn_bit_len == 64) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_64_bit[i];
-      }
-    } else if (pn_bit_len == 128) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_128_bit[i];
-      }
-    } else if (pn_bit_len == 256) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_256_bit[i];
-      }
-    } else if (pn_bit_len == 512) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_512_bit[i];
-      }
-    } else if (pn_bit_len == 1024) {
-      for (i = 0; i < pn_bit_len; i++) {
-        pn_bits[i] = pn_1024_bit[i];
-      }
+    // Usually done in the background at startup, and kept by the session
+    // once a scan has used it
+    start = g_get_monotonic_time();
+    const spec_real *pn_response = acq_session_pn_response(params->session, pn_bit_len,
+                                                           mod_freq, pn_samps_per_bit);
+    stage_record(&scan->timing, STAGE_PN_RESPONSE, start);
+    if (pn_response == NULL) {
+      // Finalized data would all be zeros, so don't take any
+      g_print("No PN response for a %d bit code at %d MHz, so the scan can't save Finalized or PN FFT data\n",
+              pn_bit_len, mod_freq);
+      scan_context_free(scan);
+      acq_session_release(params->session);
+      stop_wvfm_gen();
+      return -1;
     }
+    scan->pn_interp_fft = pn_response + scan->roi_first;
+  } /* if for final data */
 
-    // This generates the FFT of the PN code for the current bit length and
-    // modulation frequency.
-    generate_pn_fft(mod_freq, pn_bit_len, pn_bits, fft_length,
-                    pn_fft_freq, pn_fft_pow);
-
-    // This interpolates our FFT of the PN code to the same frequencies as the
-    // data from the spectrometer. We do this here so it's only done once no
-    // matter how many measurement repetitions we do.
-    interpolate_fft_data(numPixels, frequencies, fft_length, pn_fft_freq,
-                         pn_fft_pow, pn_interp_fft);
+  // Spectra are corrected and written out on their own thread, so the
+  // spectrometer never waits on the disk:
+  GThread *outputThread = g_thread_new("scan_output", output_spectra, scan);
+  int cancelled = 0;
 
-    g_free(pn_fft_freq);
-    g_free(pn_fft_pow);
-  } /* if for final data */
+  if (BURST_READOUT) {
+    // The spectrometer starts filling its buffer now, one spectrum after another
+    unsigned long int capacity = start_burst_readout(scan->spectrometer,
+                                                     SPECTROMETER_BUFFER_SPECTRA);
+    g_print("Burst readout, the spectrometer can hold %lu spectra\n", capacity);
+  }
+  // How long to wait before checking the buffer (or for a cancel) again, a
+  // quarter of a spectrum but no more than ACQ_POLL_INTERVAL_MAX
+  gulong pollInterval = CLAMP(integrationTime * 250, 1000,
+                              ACQ_POLL_INTERVAL_MAX * 1000); // in us
 
-  // Set the integration time for the measurements:
-  set_integration_time(integrationTime);
+  scan_context_seal(scan); // Heap use is measured from here
 
 g_print("About to take spectra...\n");
+  gint64 scanStart = g_get_monotonic_time(); // For the duty cycle
+  scan->start_time = scanStart;
+  gint64 lateAfter = 2 * (gint64 )integrationTime * 1000; // us
   // Cycle for each measurement repetition:
-  for (i = 0; i < measurement_reps; i++) {
+  i = 0;
+  while (stream || i < measurement_reps) {
     // Check if we've been cancelled:
     if (g_cancellable_is_cancelled(params->cancellable)) {
-      g_source_remove(params->timeoutID); // Turn off update for progressbar
-
-      // Free data that stays in this function:
-      g_free(pn_interp_fft);
-      g_free(wavelengths);
-      g_free(frequencies);
-      g_free(values);
-
-      g_free(params->outputPtr);
-      g_free(params);
-
-      return 1; // Memory freeing function called automatically
+      cancelled = 1;
+      break;
     } /* if cancelled */
 
-    // Clear spectrometer data buffer -- otherwise we'll get the same spectrum
-    // for each repetition after the first as that will be the first "available"
-    // spectrum
-    clear_spectrometer_buffer();
-
-    // Take data!
-    get_spectrum(values); // This automatically applies corrections
-                          // (e.g. dark pixels and nonlinearity)
-
-    // Add checking for saturated pixels???
-
-    // We're now ready to process / output our data (if requested):
-    // Export raw data if requested:
-    output_data(numPixels, frequencies, values, pn_interp_fft, i, params);
+    // Or have enough signal already (measurement_reps is then just a ceiling):
+    if (g_atomic_int_get(&scan->target_reached)) {
+      break;
+    }
 
-  } /* i for loop */
+    if (!BURST_READOUT) {
+      // Clear spectrometer data buffer -- otherwise we'll get the same spectrum
+      // for each repetition after the first as that will be the first "available"
+      // spectrum
+      start = g_get_monotonic_time();
+      clear_spectrometer_buffer(scan->spectrometer);
+      stage_record(&scan->timing, STAGE_CLEAR_BUFFER, start);
+    }
 
-  if (params->outputPtr->final_data || params->outputPtr->pn_fft_data) {
-    g_free(pn_interp_fft); // Free if we allocated it
-  }
+    // Rather than block in read_spectrum for a whole integration time, wait
+    // here where we can still notice a cancel
+    start = g_get_monotonic_time();
+    int available = wait_for_spectra(scan->spectrometer, params->cancellable,
+                                     pollInterval);
+    stage_record(&scan->timing, STAGE_WAIT_SPECTRUM, start);
+    if (available == 0) {
+      clear_spectrometer_buffer(scan->spectrometer); // Throw away the spectrum in progress
+      cancelled = 1;
+      break;
+    }
+    if (!BURST_READOUT) {
+      available = 1; // Only the fresh one
+    }
 
-  // If we reach here, we're done!
-  gdk_threads_add_idle(complete_progressBar, params); // This also turns off the progress bar updates
+    // Read everything that's ready before asking the spectrometer again
+    for (; available > 0 && (stream || i < measurement_reps); available--, i++) {
+      // Waits only if the output thread has fallen SPECTRUM_RING_SLOTS behind
+      spec_real *values = spectrum_ring_begin_write(&scan->ring);
+
+      // Take data! In burst mode this is the oldest spectrum in the buffer.
+      // Corrections (e.g. dark pixels and nonlinearity) are applied on the
+      // output thread
+      start = g_get_monotonic_time();
+      read_spectrum(scan->spectrometer, values);
+      gint64 acquired = g_get_monotonic_time(); // SeaBreeze has no device timestamp
+      stage_add(&scan->timing, STAGE_READ_SPECTRUM, acquired - start);
+
+      // In burst mode spectra already in the buffer are read back to back, so
+      // the time we read them says nothing about when they were taken
+      if (!BURST_READOUT) {
+        gint64 interval = cadence_add(&scan->cadence, acquired, lateAfter);
+        if (interval > lateAfter) {
+          g_print("Repetition %d came %.1f ms after the last, more than twice the integration time\n",
+                  i, interval / 1000.0);
+        }
+      }
 
+      spectrum_ring_end_write(&scan->ring, i, acquired);
+    }
 
-  //free_data_acq_data(params);
-  g_free(values);
-  g_free(wavelengths);
-  g_free(frequencies);
+    double duty = duty_cycle(i, integrationTime, g_get_monotonic_time() - scanStart);
+    g_atomic_int_set(&params->dutyPermille, (gint )(1000.0 * duty + 0.5));
+  } /* i loop */
+  gint64 scanTime = g_get_monotonic_time() - scanStart;
+
+  // Let the output thread finish with the spectra we've already taken:
+  spectrum_ring_close(&scan->ring);
+  g_thread_join(outputThread);
+  gchar *heapReport = scan_heap_report(scan); // Before anything else allocates
+  stage_timings_print(&scan->timing);
+
+  // Into the summary file too, so changes to the setup can be compared later
+  gchar *dutyReport = duty_cycle_report(&scan->timing, i, integrationTime, scanTime);
+  gchar *cadenceReport = (BURST_READOUT) ?
+    g_strdup("No time between spectra with burst readout, SeaBreeze doesn't say when each was taken\n") :
+    cadence_report(&scan->cadence);
+  gchar *report = g_strconcat(dutyReport, cadenceReport, heapReport, NULL);
+  g_print("%s", report);
+  output_summary(scan, report);
+  g_free(dutyReport);
+  g_free(cadenceReport);
+  g_free(heapReport);
+  g_free(report);
+
+  // Free data that stays in this function:
+  scan_context_free(scan);
+  acq_session_release(params->session);
+
+  // Done with the waveform generator, here rather than from the Stop button so
+  // only one thread at a time ever talks to it
   stop_wvfm_gen();
 
+  if (cancelled && !stream) { // Cancelling is how a stream ends normally
+    return 1;
+  }
+
+  // If we reach here, we're done! params is freed by scan_done_cb()
   return 0;
 }
 
+//========================================================
+// A scan is one GTask from Start Scan until it's over. The waveform generator
+// and spectrometer are set up at the same time, each on its own thread, and
+// the scan runs in the task's thread once both are ready. None of it blocks
+// the UI, and bring-up only takes as long as the slower device.
+
+struct scanTask {
+  struct dataAcqParams *params;
+  GTask *task; // For the whole scan, its callback is scan_done_cb()
+  GCancellable *cancellable;
+  GAsyncReadyCallback callback; // Called once the scan is over, can be NULL
+  gpointer user_data;
+  int pending; // Devices that aren't ready yet, only used on the main thread
+  GError *error; // Why a device couldn't be set up, if one couldn't
+  int result; // 0 when finished, 1 if stopped early, -1 if it couldn't start
+};
+
 static void data_acq_cb(GTask    *task,
                         gpointer source_object,
                         gpointer task_data,
                         GCancellable *cancellable)
 {
-  struct dataAcqParams *params = task_data;
-  int retval;
+  struct scanTask *scanTask = task_data;
 
   // Handle Cancellation:
-  if(g_task_return_error_if_cancelled(task))
-  {
+  if (g_cancellable_is_cancelled(cancellable)) {
+    // Stopped after bring-up but before we got here, so there's nothing to
+    // save, but the waveform generator is already running
+    stop_wvfm_gen();
+    scanTask->result = 1;
+  } else {
+g_print("Inside data_acq_cb...\n");
+    // Run the actual function:
+    scanTask->result = data_acq(scanTask->params);
+  }
+
+  g_task_return_int(task, scanTask->result);
+}
+
+// Runs on the main thread once the scan is over, whether it finished, was
+// stopped or never started. Until now Start Scan stays insensitive, so a new
+// scan can't set up the devices while this one's threads still use them.
+static void scan_done_cb(GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  struct scanTask *scanTask = user_data;
+
+  complete_progressBar(scanTask->params, scanTask->result == 0);
+  if (scanTask->callback) {
+    scanTask->callback(source_object, result, scanTask->user_data);
+  }
+  g_clear_error(&scanTask->error);
+  g_free(scanTask);
+}
+
+static void wvfm_bring_up_cb(GTask    *task,
+                             gpointer source_object,
+                             gpointer task_data,
+                             GCancellable *cancellable)
+{
+  struct dataAcqParams *params = task_data;
+
+  // A scan without modulation would be useless, so don't start one
+  if (start_wvfm_gen(params->pn_bit_length, params->mod_freq) < 0) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "the waveform generator can't output a %d bit code at %d MHz",
+                            params->pn_bit_length, params->mod_freq);
     return;
   }
-g_print("Inside data_acq_cb...\n");
-  // Run the actual function:
-  retval = data_acq(params);
+  g_task_return_boolean(task, TRUE);
+}
 
-  g_task_return_int(task, retval);
+static void spectrometer_bring_up_cb(GTask    *task,
+                                     gpointer source_object,
+                                     gpointer task_data,
+                                     GCancellable *cancellable)
+{
+  struct dataAcqParams *params = task_data;
+
+  // Only the first scan with a spectrometer (or after switching to another)
+  // has to ask it for anything
+  gint64 start = g_get_monotonic_time();
+  if (acq_session_use_spectrometer(params->session, params->spectrometerId) < 0) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_BUSY,
+                            "the last scan is still using the spectrometer");
+    return;
+  }
+  acq_session_set_integration_time(params->session, params->integrationTime);
+  params->openTime = g_get_monotonic_time() - start;
+
+  g_task_return_boolean(task, TRUE);
 }
 
+// Runs on the main thread as each device finishes
+static void device_ready_cb(GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  struct scanTask *scanTask = user_data;
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean(G_TASK(result), &error)) {
+    if (scanTask->error == NULL) {
+      scanTask->error = error; // Keep the first reason
+    } else {
+      g_error_free(error);
+    }
+  }
+
+  scanTask->pending--;
+  if (scanTask->pending > 0) {
+    return; // Still waiting on the other one
+  }
+
+  if (g_cancellable_is_cancelled(scanTask->cancellable) || scanTask->error) {
+    // Stopped (or failed) before the scan started. Both threads are done, so
+    // this is the only one using the waveform generator
+    if (!g_cancellable_is_cancelled(scanTask->cancellable)) {
+      g_print("Unable to start the scan: %s\n", scanTask->error->message);
+    }
+    stop_wvfm_gen();
+    scanTask->result = g_cancellable_is_cancelled(scanTask->cancellable) ? 1 : -1;
+    g_task_return_int(scanTask->task, scanTask->result);
+  } else {
+g_print("Starting task...\n");
+    // Run the acquisition in a worker thread:
+    g_task_run_in_thread(scanTask->task, data_acq_cb);
+  }
+  g_object_unref(scanTask->task);
+}
+
+void start_device_bring_up(struct scanTask *scanTask,
+                           GTaskThreadFunc bring_up_func)
+{
+  GTask *task = g_task_new(NULL, scanTask->cancellable, device_ready_cb, scanTask);
+  g_task_set_source_tag(task, start_data_acq_async);
+  g_task_set_task_data(task, scanTask->params, NULL);
+  g_task_run_in_thread(task, bring_up_func);
+  g_object_unref(task);
+}
+
+// Set up both devices, then take data. Everything here happens off the UI
+// thread, which only hears back when each device is ready and when the scan
+// is over. params (and its outputPtr) belong to the scan from here on.
 void start_data_acq_async(gpointer            data, // Input data
                           GCancellable       *cancellable,
                           GAsyncReadyCallback callback,
                           gpointer            user_data)
 {
-g_print("Starting task...\n");
-  GTask *task = NULL;
-  struct dataAcqParams *params;
-  params = (struct dataAcqParams *) data;
-//printf("Btn Pointer Async: %p\n", params->scan_btn);
   // Error if this is badly formatted:
   g_return_if_fail( (cancellable == NULL) | G_IS_CANCELLABLE(cancellable) );
-g_print("Set as cancellable???\n");
-  task = g_task_new(NULL, cancellable, callback, user_data);
-  g_task_set_source_tag(task, start_data_acq_async);
 
-  g_task_set_return_on_cancel(task, FALSE);
-
-  // Prepare our owned data:
-  //params = g_malloc(sizeof(*params));
-  //*params = *data; // Copy to our local version
-
-  g_task_set_task_data(task, params, free_data_acq_data);
-
-  // Run the acquisition in a worker thread:
-  g_task_run_in_thread(task, data_acq_cb);
-g_print("done starting task...\n");
-  g_object_unref(task);
+  struct scanTask *scanTask = g_malloc0(sizeof(*scanTask));
+  scanTask->params = (struct dataAcqParams *) data;
+  scanTask->cancellable = cancellable;
+  scanTask->callback = callback;
+  scanTask->user_data = user_data;
+  scanTask->pending = 2;
+
+  scanTask->task = g_task_new(NULL, cancellable, scan_done_cb, scanTask);
+  g_task_set_source_tag(scanTask->task, start_data_acq_async);
+  g_task_set_return_on_cancel(scanTask->task, FALSE);
+  // data_acq_cb() decides what a cancel means (a stream ends that way)
+  g_task_set_check_cancellable(scanTask->task, FALSE);
+  g_task_set_task_data(scanTask->task, scanTask, NULL);
+
+  start_device_bring_up(scanTask, wvfm_bring_up_cb);
+  start_device_bring_up(scanTask, spectrometer_bring_up_cb);
 }
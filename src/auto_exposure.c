@@ -0,0 +1,114 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Automatic exposure: take a few probe spectra, and from the brightest
+// (dark corrected) pixel in the region of interest predict the integration time that puts it at
+// AUTO_EXPOSURE_TARGET of full scale, assuming counts grow linearly with time.
+
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include "auto_exposure.h"
+#include "acquire_data.h"
+#include "measurement_params.h"
+#include "spectrometer_functions.h"
+
+spec_real spectrum_peak(int numPixels, const spec_real values[])
+{
+  int i;
+  spec_real peak = values[0];
+  for (i = 1; i < numPixels; i++) {
+    peak = MAX(peak, values[i]);
+  }
+  return peak;
+}
+
+// A spectrum taken entirely at the current integration time. Whatever was
+// integrating when it was changed is thrown away. Returns 0 if cancelled.
+int take_probe(struct spectrometer *spec,
+               int integrationTime,
+               GCancellable *cancellable,
+               spec_real probe[])
+{
+  gulong pollInterval = CLAMP(integrationTime * 250, 1000,
+                              ACQ_POLL_INTERVAL_MAX * 1000); // in us
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    clear_spectrometer_buffer(spec);
+    if (wait_for_spectra(spec, cancellable, pollInterval) == 0) {
+      return 0;
+    }
+  }
+  read_spectrum(spec, probe);
+  return 1;
+}
+
+// Choose (and set) the integration time for a scan, no longer than maxTime.
+// Only pixels first to first + count - 1 count, so a bright line outside the
+// region of interest doesn't set the exposure. Stops early if cancelled, with
+// the best time found so far.
+int auto_exposure(struct acqSession *session,
+                  int first,
+                  int count,
+                  int maxTime,
+                  GCancellable *cancellable,
+                  spec_real probe[])
+{
+  struct spectrometer *spec = session->spectrometer;
+  struct darkHistory dark;
+  double fullScale = spec->max_intensity;
+  double target = AUTO_EXPOSURE_TARGET * fullScale;
+  int minTime = MAX(1, (int )((spec->min_integration_us + 999) / 1000));
+  int time, next, probes;
+
+  if (spec->max_integration_us > 0) {
+    maxTime = MIN(maxTime, (int )(spec->max_integration_us / 1000));
+  }
+  maxTime = MAX(maxTime, minTime);
+  time = CLAMP(AUTO_EXPOSURE_FIRST_PROBE, minTime, maxTime);
+
+  for (probes = 0; probes < AUTO_EXPOSURE_MAX_PROBES; probes++) {
+    acq_session_set_integration_time(session, time);
+    if (!take_probe(spec, time, cancellable, probe)) {
+      break;
+    }
+
+    double rawPeak = spectrum_peak(count, probe + first);
+    dark_history_reset(&dark); // Baseline from this probe alone
+    do_edark_correction(spec, &dark, probe, first, first + count);
+    double peak = spectrum_peak(count, probe + first);
+
+    if (rawPeak >= AUTO_EXPOSURE_SATURATED * fullScale) {
+      next = time / AUTO_EXPOSURE_BACKOFF; // Saturated, the peak doesn't say by how much
+    } else if (peak <= 0.0) {
+      next = maxTime; // Nothing above the dark level at all
+    } else {
+      next = (int )((double )time * target / peak + 0.5);
+    }
+    next = CLAMP(next, minTime, maxTime);
+    g_print("Auto exposure probe %d: %d ms, peak %.0f of %.0f counts, next %d ms\n",
+            probes + 1, time, rawPeak, fullScale, next);
+
+    if (abs(next - time) <= MAX(1, (int )(AUTO_EXPOSURE_TOLERANCE * time))) {
+      time = next; // Converged
+      break;
+    }
+    time = next;
+  }
+
+  acq_session_set_integration_time(session, time);
+  return time;
+}
@@ -0,0 +1,89 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Streaming mean and standard deviation of every pixel over the repetitions
+// of a scan, so they can be saved as one file instead of one per repetition.
+
+#include <math.h>
+
+#include "coadd.h"
+
+void coadd_init(struct coaddStats *stats,
+                int numPixels,
+                double mean[],
+                double m2[])
+{
+  int i;
+  stats->numPixels = numPixels;
+  stats->count = 0;
+  stats->mean = mean;
+  stats->m2 = m2;
+  for (i = 0; i < numPixels; i++) {
+    mean[i] = 0.0;
+    m2[i] = 0.0;
+  }
+}
+
+// Welford's update, one pass with no branches so it vectorizes
+void coadd_add(struct coaddStats *stats, const spec_real *restrict values)
+{
+  int i;
+  double *restrict mean = stats->mean;
+  double *restrict m2 = stats->m2;
+  double inv_count;
+
+  stats->count++;
+  inv_count = 1.0 / (double )stats->count;
+
+  for (i = 0; i < stats->numPixels; i++) {
+    double x = (double )values[i];
+    double delta = x - mean[i];
+    mean[i] += delta * inv_count;
+    m2[i] += delta * (x - mean[i]);
+  }
+}
+
+// Sample standard deviation of one pixel
+double coadd_std(const struct coaddStats *stats, int pixel)
+{
+  if (stats->count < 2) {
+    return 0.0;
+  }
+  return sqrt(stats->m2[pixel] / (double )(stats->count - 1));
+}
+
+// Signal to noise ratio of the mean spectrum summed over a band of pixels:
+// the sum of the means over the standard error of that sum. 0 until there are
+// at least two spectra to estimate the noise from.
+double coadd_band_snr(const struct coaddStats *stats, int first, int last)
+{
+  int i;
+  double signal = 0.0;
+  double m2 = 0.0;
+
+  if (stats->count < 2) {
+    return 0.0;
+  }
+  for (i = first; i < last; i++) {
+    signal += stats->mean[i];
+    m2 += stats->m2[i];
+  }
+  // Variance of the sum of the means, assuming the pixels are independent
+  double variance = m2 / ((double )(stats->count - 1) * (double )stats->count);
+  if (variance <= 0.0) {
+    return (signal != 0.0) ? INFINITY : 0.0;
+  }
+  return fabs(signal) / sqrt(variance);
+}
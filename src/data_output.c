@@ -16,11 +16,15 @@
 // File to handle convoluting and outputting the data:
 
 #include <stdio.h>
+#include <math.h>
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 
 #include "acquire_data.h"
 #include "data_output.h"
+#include "scan_context.h"
+#include "measurement_params.h"
 
 // May need to adjust to longer precision...
 void write_line(FILE *filePtr, double x, double y)
@@ -29,89 +33,247 @@ void write_line(FILE *filePtr, double x, double y)
   return;
 }
 
-void output_data(int numPixels,
-                 double xVals[],
-                 double pixelValues[],
-                 double pn_interp_fft[],
-                 int iteration,
-                 struct dataAcqParams *params)
+// Write one spectrum as x,y pairs after the scan's header
+void write_spectrum(const gchar *path,
+                    const gchar *header,
+                    int numPixels,
+                    const spec_real xVals[],
+                    const spec_real yVals[],
+                    const spec_real scale[]) // multiplies yVals if not NULL
 {
-g_print("Outputting data...\n");
   int i;
-  // Get the information about which outputs / where they should go:
-  struct dataOutputOpts *outputPtr = params->outputPtr;
-  const gchar *baseFname = outputPtr->fname;
-  const gchar *data_dir = outputPtr->data_dir;
-  gchar *basePath = g_strjoin("/", data_dir, baseFname, NULL);
-  gchar headerLines[500];
-  sprintf(headerLines,
-    "Data modulated at %d MHz with a PN code length of %d, and integrated for %d msec\nWavenumber (cm^-1), intensity\n",
-     params->mod_freq, params->pn_bit_length, params->integrationTime);
-g_print(baseFname);
-g_print("\n");
-g_print(data_dir);
-g_print("\n");
-g_print(basePath);
-g_print("\n");
-
-  // Output raw spectrometer data
-  if (outputPtr->raw_data) {
-    gchar iterText[10];
-    sprintf(iterText, "%d", iteration);
-    gchar *fullURI = g_strjoin(NULL, basePath, "_raw_", iterText, ".txt", NULL);
-    gchar *fullPath = g_filename_from_uri(fullURI, NULL, NULL);
-
-    FILE *outFile;
-    outFile = fopen(fullPath, "w");
-    fprintf(outFile, headerLines);
-
-    for (i = 0; i < numPixels; i++) {
-      write_line(outFile, xVals[i], pixelValues[i]);
+  FILE *outFile;
+
+  if (path == NULL || (outFile = fopen(path, "w")) == NULL) {
+    g_print("Unable to write data to %s\n", (path) ? path : "(invalid folder)");
+    return;
+  }
+  fputs(header, outFile);
+  fputs("Wavenumber (cm^-1), intensity\n", outFile);
+
+  for (i = 0; i < numPixels; i++) {
+    if (scale) {
+      double value = (double )yVals[i] * scale[i]; // point-wise multiplication
+      write_line(outFile, xVals[i], value);
+    } else {
+      write_line(outFile, xVals[i], yVals[i]);
     }
+  }
+
+  fclose(outFile);
+}
 
-    g_free(fullPath);
-    g_free(fullURI);
-    fclose(outFile);
+// File names are written into the scan context's path buffer
+void output_data(struct scanContext *scan,
+                 spec_real pixelValues[],
+                 int iteration)
+{
+  // Get the information about which outputs / where they should go:
+  struct dataOutputOpts *outputPtr = scan->params->outputPtr;
+
+  // Output raw spectrometer data (co-adding and streaming replace the files for
+  // each rep)
+  if (outputPtr->raw_data && !outputPtr->coadd && !outputPtr->stream &&
+      scan->raw_prefix) {
+    g_snprintf(scan->path_buf, scan->path_buf_len, "%s%d.txt",
+               scan->raw_prefix, iteration);
+    write_spectrum(scan->path_buf, scan->header, scan->numPixels,
+                   scan->frequencies, pixelValues, NULL);
   }
 
   // Output our interpolated PN FFT
   if (outputPtr->pn_fft_data && iteration == 0) {
     // Only output this once, as it's constant as a function of iteration
-    gchar *fullURI = g_strjoin(NULL, basePath, "_pn_fft.txt", NULL);
-    gchar *fullPath = g_filename_from_uri(fullURI, NULL, NULL);
-    FILE *outFile;
-    outFile = fopen(fullPath, "w");
-    fprintf(outFile, headerLines);
-
-    for (i = 0; i < numPixels; i++) {
-      write_line(outFile, xVals[i], pn_interp_fft[i]);
+    write_spectrum(scan->pn_fft_path, scan->header, scan->numPixels,
+                   scan->frequencies, scan->pn_interp_fft, NULL);
+  }
+
+  // Output the point-wise multiplication of spectrum and PN FFT
+  if (outputPtr->final_data && !outputPtr->coadd && !outputPtr->stream &&
+      scan->final_prefix) {
+    g_snprintf(scan->path_buf, scan->path_buf_len, "%s%d.txt",
+               scan->final_prefix, iteration);
+    write_spectrum(scan->path_buf, scan->header, scan->numPixels,
+                   scan->frequencies, pixelValues, scan->pn_interp_fft);
+  }
+
+  return;
+}
+
+// Write the co-added repetitions so far: the mean and standard deviation of
+// each pixel, and if finalized data was requested the same after multiplying
+// by the PN FFT. Overwrites any earlier checkpoint.
+void output_coadd(struct scanContext *scan)
+{
+  int i;
+  FILE *outFile;
+  struct dataOutputOpts *outputPtr = scan->params->outputPtr;
+  struct coaddStats *coadd = &scan->coadd;
+  int final = outputPtr->final_data && scan->pn_interp_fft;
+
+  if (scan->coadd_path == NULL || (outFile = fopen(scan->coadd_path, "w")) == NULL) {
+    g_print("Unable to write data to %s\n",
+            (scan->coadd_path) ? scan->coadd_path : "(invalid folder)");
+    return;
+  }
+
+  fputs(scan->header, outFile);
+  if (outputPtr->stream) {
+    fprintf(outFile, "Co-added %d repetitions\n", coadd->count);
+  } else {
+    fprintf(outFile, "Co-added %d of %d repetitions\n", coadd->count,
+            scan->params->measurement_reps);
+  }
+  fputs((final) ? "Wavenumber (cm^-1), mean intensity, standard deviation, final intensity, final standard deviation\n" :
+                  "Wavenumber (cm^-1), mean intensity, standard deviation\n", outFile);
+
+  for (i = 0; i < scan->numPixels; i++) {
+    double std = coadd_std(coadd, i);
+    if (final) {
+      double pn = scan->pn_interp_fft[i];
+      fprintf(outFile, "%lf,%.15lf,%.15lf,%.15lf,%.15lf\n", (double )scan->frequencies[i],
+              coadd->mean[i], std, coadd->mean[i] * pn, std * fabs(pn));
+    } else {
+      fprintf(outFile, "%lf,%.15lf,%.15lf\n", (double )scan->frequencies[i],
+              coadd->mean[i], std);
     }
+  }
+
+  fclose(outFile);
+}
+
+// How the scan went (e.g. its duty cycle), after the same header as the data
+void output_summary(struct scanContext *scan, const gchar *report)
+{
+  FILE *outFile;
 
-    fclose(outFile);
-    g_free(fullPath);
-    g_free(fullURI);
+  if (scan->summary_path == NULL || (outFile = fopen(scan->summary_path, "w")) == NULL) {
+    g_print("Unable to write data to %s\n",
+            (scan->summary_path) ? scan->summary_path : "(invalid folder)");
+    return;
   }
 
-  // Output the point-wise multiplication of spectrum and PN FFT
-  if (outputPtr->final_data) {
-    gchar iterText[10];
-    sprintf(iterText, "%d", iteration);
-    gchar *fullURI = g_strjoin(NULL, basePath, "_final_", iterText, ".txt", NULL);
-    gchar *fullPath = g_filename_from_uri(fullURI, NULL, NULL);
-
-    FILE *outFile;
-    outFile = fopen(fullPath, "w");
-    fprintf(outFile, headerLines);
-
-    for (i = 0; i < numPixels; i++) {
-      double value = pixelValues[i] * pn_interp_fft[i]; // point-wise multiplication
-      write_line(outFile, xVals[i], value);
+  fputs(scan->header, outFile);
+  fputs(report, outFile);
+  fclose(outFile);
+}
+
+// Start the next streaming segment, closing the current one and removing the
+// oldest if we're only keeping STREAM_KEEP_SEGMENTS. If it can't be opened
+// segment_failed is set, and that's only reported once until one opens again.
+void open_segment(struct scanContext *scan)
+{
+  int i;
+
+  close_stream(scan);
+  if (scan->stream_prefix == NULL) {
+    if (!scan->segment_failed) {
+      g_print("Unable to write data to (invalid folder)\n");
     }
-    g_free(fullPath);
-    g_free(fullURI);
-    fclose(outFile);
+    scan->segment_failed = 1;
+    return;
   }
 
-  g_free(basePath);
-  return;
+  if (STREAM_KEEP_SEGMENTS > 0 && scan->segment_index >= STREAM_KEEP_SEGMENTS) {
+    g_snprintf(scan->path_buf, scan->path_buf_len, "%s%d.txt", scan->stream_prefix,
+               scan->segment_index - STREAM_KEEP_SEGMENTS);
+    g_remove(scan->path_buf);
+  }
+
+  g_snprintf(scan->path_buf, scan->path_buf_len, "%s%d.txt", scan->stream_prefix,
+             scan->segment_index);
+  scan->segment_index++;
+  scan->segment_file = fopen(scan->path_buf, "w");
+  if (scan->segment_file == NULL) {
+    if (!scan->segment_failed) {
+      g_print("Unable to write data to %s, trying again every %d spectra\n",
+              scan->path_buf, STREAM_SEGMENT_SPECTRA);
+    }
+    scan->segment_failed = 1;
+    return;
+  }
+  scan->segment_failed = 0;
+
+  fputs(scan->header, scan->segment_file);
+  fputs((scan->params->outputPtr->final_data && scan->pn_interp_fft) ?
+        "Finalized data, one repetition per line. First line is wavenumber (cm^-1)\n" :
+        "Intensity, one repetition per line. First line is wavenumber (cm^-1)\n",
+        scan->segment_file);
+  fputs("repetition,time (us)", scan->segment_file);
+  for (i = 0; i < scan->numPixels; i++) {
+    fprintf(scan->segment_file, ",%lf", (double )scan->frequencies[i]);
+  }
+  fputc('\n', scan->segment_file);
+}
+
+// Append one spectrum to the current segment, only one file is ever open
+void output_stream(struct scanContext *scan,
+                   spec_real pixelValues[],
+                   int iteration,
+                   gint64 timestamp)
+{
+  int i;
+  int final = scan->params->outputPtr->final_data && scan->pn_interp_fft;
+
+  // A segment that couldn't be opened is only tried again where the next one
+  // would start, its spectra are dropped
+  if (scan->segment_spectra >= STREAM_SEGMENT_SPECTRA ||
+      (scan->segment_file == NULL && !scan->segment_failed)) {
+    open_segment(scan);
+  }
+  if (scan->segment_file == NULL) {
+    scan->segment_spectra++;
+    return;
+  }
+
+  fprintf(scan->segment_file, "%d,%" G_GINT64_FORMAT, iteration,
+          timestamp - scan->start_time);
+  for (i = 0; i < scan->numPixels; i++) {
+    double value = (final) ? (double )pixelValues[i] * scan->pn_interp_fft[i] :
+                             (double )pixelValues[i];
+    fprintf(scan->segment_file, ",%.15lf", value);
+  }
+  fputc('\n', scan->segment_file);
+  scan->segment_spectra++;
+}
+
+void close_stream(struct scanContext *scan)
+{
+  if (scan->segment_file) {
+    fclose(scan->segment_file);
+    scan->segment_file = NULL;
+  }
+  scan->segment_spectra = 0;
+}
+
+// When each repetition was acquired (the host's clock, once the spectrum had
+// been read), one per line. Streaming has these in its segment files instead.
+void output_timestamp(struct scanContext *scan,
+                      int iteration,
+                      gint64 timestamp)
+{
+  if (scan->timestamps_file == NULL) {
+    if (scan->timestamps_failed) {
+      return; // Already reported, don't try again every repetition
+    }
+    if (scan->timestamps_path == NULL ||
+        (scan->timestamps_file = fopen(scan->timestamps_path, "w")) == NULL) {
+      g_print("Unable to write data to %s\n",
+              (scan->timestamps_path) ? scan->timestamps_path : "(invalid folder)");
+      scan->timestamps_failed = 1;
+      return;
+    }
+    fputs(scan->header, scan->timestamps_file);
+    fputs("repetition, time since the scan started (us)\n", scan->timestamps_file);
+  }
+  fprintf(scan->timestamps_file, "%d,%" G_GINT64_FORMAT "\n", iteration,
+          timestamp - scan->start_time);
+}
+
+void close_timestamps(struct scanContext *scan)
+{
+  if (scan->timestamps_file) {
+    fclose(scan->timestamps_file);
+    scan->timestamps_file = NULL;
+  }
 }
@@ -20,14 +20,193 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <gtk/gtk.h>
 #include "complex.h"
 #include "fftw3.h"
 
-const static unsigned long isamps_per_bit = 512; // Number of samples per bit in PN.
-                                 // Keep as power of 2 to make FFT fast
-                                 // Sort of arbitrary, but some testing in
-                                 // MATLAB indicates this should be plenty
+#include "fft_functions.h"
+
+// FFTW plans are kept along with the buffers they were planned for, so
+// repeated scans don't pay for planning or allocation. Only FFT_PLAN_CACHE_BYTES
+// of buffers are kept, the least recently used plans go first, and a transform
+// too big to fit is planned for each use and freed after. Plans are made with
+// FFTW_MEASURE (up to FFT_MEASURE_MAX_LEN) and saved as wisdom between runs.
+struct fftPlanEntry {
+  unsigned long int n; // Length of the real input
+  spec_real *in; // n elements
+  FFTW(complex) *out; // n/2 + 1 elements
+  FFTW(plan) plan;
+  gsize bytes; // Of in and out
+  guint64 last_used;
+  int cached; // In plan_cache, otherwise freed by release_r2c_plan()
+};
+
+static GHashTable *plan_cache = NULL; // fftPlanEntry keyed by transform length
+static GMutex plan_cache_lock; // FFTW's planner is not thread safe, and the
+                               // buffers are shared, so hold this while in use
+static gsize plan_cache_bytes = 0; // Buffers held by plan_cache
+static guint64 plan_cache_uses = 0;
+static gchar *wisdom_file = NULL;
+static int fft_threads_ready = 0;
+
+// Most buffer memory kept between transforms (the PN FFTs of the longest codes
+// need several hundred MB each, and are only done once per session)
+#define FFT_PLAN_CACHE_BYTES (64UL << 20)
+
+// Measuring plans for transforms longer than this takes longer than the
+// transforms themselves, so they're estimated instead
+#define FFT_MEASURE_MAX_LEN (1UL << 20)
+
+// Transforms at least this long are split across all cores, below this the
+// overhead of the threads isn't worth it
+#define FFT_THREADS_MIN_LEN (1UL << 18)
+
+// Has to happen before any other FFTW call, call with plan_cache_lock held
+void init_fft_threads()
+{
+  if (!fft_threads_ready) {
+    fft_threads_ready = FFTW(init_threads)();
+    if (!fft_threads_ready) {
+      g_print("Unable to start FFTW threads, transforms will be single threaded\n");
+    }
+  }
+}
+
+void free_plan_entry(gpointer data)
+{
+  struct fftPlanEntry *entry = data;
+  FFTW(destroy_plan)(entry->plan);
+  FFTW(free)(entry->in);
+  FFTW(free)(entry->out);
+  g_free(entry);
+}
+
+// Load any saved wisdom, call once at startup before any transforms
+void fft_plans_init(const char *wisdom_path)
+{
+  g_mutex_lock(&plan_cache_lock);
+  if (plan_cache == NULL) {
+    plan_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                       NULL, free_plan_entry);
+  }
+  init_fft_threads();
+  g_free(wisdom_file);
+  wisdom_file = g_strdup(wisdom_path);
+  if (wisdom_file && !FFTW(import_wisdom_from_filename)(wisdom_file)) {
+    g_print("No FFTW wisdom loaded from %s\n", wisdom_file);
+  }
+  g_mutex_unlock(&plan_cache_lock);
+}
+
+// Save wisdom for the plans made this session and free all of them
+void fft_plans_shutdown()
+{
+  g_mutex_lock(&plan_cache_lock);
+  if (wisdom_file) {
+    gchar *dir = g_path_get_dirname(wisdom_file);
+    g_mkdir_with_parents(dir, 0755);
+    if (!FFTW(export_wisdom_to_filename)(wisdom_file)) {
+      g_print("Unable to save FFTW wisdom to %s\n", wisdom_file);
+    }
+    g_free(dir);
+    g_free(wisdom_file);
+    wisdom_file = NULL;
+  }
+  if (plan_cache) {
+    g_hash_table_destroy(plan_cache);
+    plan_cache = NULL;
+    plan_cache_bytes = 0;
+  }
+  g_mutex_unlock(&plan_cache_lock);
+}
+
+// Free least recently used plans until another bytes of buffers fit, call
+// with plan_cache_lock held
+void make_room_in_plan_cache(gsize bytes)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  while (plan_cache_bytes + bytes > FFT_PLAN_CACHE_BYTES &&
+         g_hash_table_size(plan_cache) > 0) {
+    struct fftPlanEntry *oldest = NULL;
+    g_hash_table_iter_init(&iter, plan_cache);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      struct fftPlanEntry *entry = value;
+      if (oldest == NULL || entry->last_used < oldest->last_used) {
+        oldest = entry;
+      }
+    }
+    plan_cache_bytes -= oldest->bytes;
+    g_hash_table_remove(plan_cache, GUINT_TO_POINTER(oldest->n));
+  }
+}
+
+// Get the plan for a real to complex transform of length n, creating it if
+// it isn't cached. Returns with plan_cache_lock held, call release_r2c_plan()
+// when done with the plan and its buffers. Returns NULL (with the lock
+// released) if n is too large for FFTW or the buffers can't be allocated.
+struct fftPlanEntry *acquire_r2c_plan(unsigned long int n)
+{
+  struct fftPlanEntry *entry;
+
+  if (n == 0 || n > INT_MAX) { // FFTW takes the length as an int
+    g_print("FFT of length %lu is not supported\n", n);
+    return NULL;
+  }
+
+  g_mutex_lock(&plan_cache_lock);
+  if (plan_cache == NULL) { // fft_plans_init() wasn't called, so no wisdom
+    init_fft_threads();
+    plan_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                       NULL, free_plan_entry);
+  }
+
+  entry = g_hash_table_lookup(plan_cache, GUINT_TO_POINTER(n));
+  if (entry == NULL) {
+    spec_real *in = FFTW(alloc_real)(n);
+    FFTW(complex) *out = FFTW(alloc_complex)(n/2 + 1);
+    if (in == NULL || out == NULL) {
+      g_print("Unable to allocate buffers for an FFT of length %lu\n", n);
+      FFTW(free)(in);
+      FFTW(free)(out);
+      g_mutex_unlock(&plan_cache_lock);
+      return NULL;
+    }
+
+    entry = g_malloc0(sizeof(*entry));
+    entry->n = n;
+    entry->in = in;
+    entry->out = out;
+    entry->bytes = n * sizeof(*in) + (n/2 + 1) * sizeof(*out);
+    if (fft_threads_ready) {
+      FFTW(plan_with_nthreads)((n >= FFT_THREADS_MIN_LEN) ?
+                              (int )g_get_num_processors() : 1);
+    }
+    // FFTW_MEASURE overwrites the buffers, so only fill them after this
+    entry->plan = FFTW(plan_dft_r2c_1d)(n, entry->in, entry->out,
+                                        (n <= FFT_MEASURE_MAX_LEN) ?
+                                        FFTW_MEASURE : FFTW_ESTIMATE);
+    if (entry->bytes <= FFT_PLAN_CACHE_BYTES) {
+      make_room_in_plan_cache(entry->bytes);
+      g_hash_table_insert(plan_cache, GUINT_TO_POINTER(n), entry);
+      plan_cache_bytes += entry->bytes;
+      entry->cached = 1;
+    }
+  }
+  entry->last_used = ++plan_cache_uses;
+
+  return entry;
+}
+
+void release_r2c_plan(struct fftPlanEntry *entry)
+{
+  if (!entry->cached) {
+    free_plan_entry(entry); // Too big to keep
+  }
+  g_mutex_unlock(&plan_cache_lock);
+}
 
 // Function to linearly interpolate between two points to a target x-value and
 // return the predicted y-value
@@ -45,12 +224,14 @@ double interpolate_pts(double x_tar,
 // Function to interpolate our FFT results to the same frequencies as our
 // spectrometer measures at. Assume that spec_freqs and fft_freqs (and fft_pows)
 // are already sorted into ascending order (spec_freqs[0] = fft_freqs[0] = 0)
-void interpolate_fft_data(int numPixels, // in spectrometer
-                          double spec_freqs[],
+// This searches for each bracket, so it works for any fft_freqs. For evenly
+// spaced fft_freqs, interpolate_uniform_fft_data is much faster.
+void interpolate_fft_data_scan(int numPixels, // in spectrometer
+                          spec_real spec_freqs[],
                           unsigned long int fft_length,
-                          double fft_freqs[], // length of fft_length
-                          double fft_pows[], // length of fft_length
-                          double fft_interp[]) // output, length of numPixels
+                          spec_real fft_freqs[], // length of fft_length
+                          spec_real fft_pows[], // length of fft_length
+                          spec_real fft_interp[]) // output, length of numPixels
 {
   int i;
   unsigned long int j, jStart;
@@ -110,21 +291,110 @@ void interpolate_fft_data(int numPixels, // in spectrometer
 
 }
 
-unsigned long int calc_fft_length(int pn_bit_len)
+// Same as interpolate_fft_data_scan, but for an FFT axis that is evenly
+// spaced (fft_freqs[j] = f0 + j*df), so the bracketing points can be found
+// directly instead of searched for. There are no data-dependent branches in
+// the loop so the compiler is free to vectorize it. Pixels outside of
+// (fft_freqs[0], fft_freqs[fft_length-1]) are left alone, as in the scan.
+void interpolate_uniform_fft_data(int numPixels, // in spectrometer
+                                  spec_real spec_freqs[],
+                                  unsigned long int fft_length,
+                                  double f0, // fft_freqs[0]
+                                  double df, // spacing of fft_freqs
+                                  spec_real fft_pows[], // length of fft_length
+                                  spec_real fft_interp[]) // output, length of numPixels
 {
-  double total_samps = (double )pn_bit_len * (double )isamps_per_bit;
+  int i;
+  double x, w, last = (double )(fft_length - 1);
+  double inv_df = 1.0 / df;
+  long j, jMax = (long )fft_length - 2; // Last point we can interpolate from
+
+  if (fft_length < 3) {
+    return; // Nothing to bracket with, as in the scan
+  }
+
+  for (i = 0; i < numPixels; i++) {
+    x = (spec_freqs[i] - f0) * inv_df; // Fractional index on the FFT axis
+    int inRange = (x > 0.0) & (x < last);
+
+    // Clamp so the loads below are always in bounds, even when out of range
+    x = fmin(fmax(x, 0.0), last);
+    j = (long )x;
+    j = (j > jMax) ? jMax : j;
+    w = x - (double )j;
+
+    double value = (1.0 - w)*fft_pows[j] + w*fft_pows[j+1];
+    fft_interp[i] = inRange ? value : fft_interp[i];
+  }
+}
+
+// Interpolate the FFT results to the spectrometer frequencies, for an axis
+// whose spacing isn't known. If it turns out to be evenly spaced the search of
+// interpolate_fft_data_scan is skipped, but the check is a pass over the whole
+// axis, so callers with an axis from generate_pn_fft (or
+// generate_pn_fft_analytic) should call interpolate_uniform_fft_data with
+// pn_fft_spacing instead.
+void interpolate_fft_data(int numPixels, // in spectrometer
+                          spec_real spec_freqs[],
+                          unsigned long int fft_length,
+                          spec_real fft_freqs[], // length of fft_length
+                          spec_real fft_pows[], // length of fft_length
+                          spec_real fft_interp[]) // output, length of numPixels
+{
+  if (fft_length < 3) {
+    return; // Nothing to bracket with, as in the scan
+  }
+
+  double f0 = fft_freqs[0];
+  double df = (fft_freqs[fft_length - 1] - f0) / (double )(fft_length - 1);
+  // Stored axis values are rounded to spec_real, so allow for that
+  double tol = fmax(1e-9, 32.0 * SPEC_REAL_EPSILON) *
+               fabs(fft_freqs[fft_length - 1] - f0);
+  double maxDev = 0.0;
+  unsigned long int j;
+
+  // One pass with no branches, still far cheaper than the search
+  for (j = 1; j < fft_length - 1; j++) {
+    maxDev = fmax(maxDev, fabs(fft_freqs[j] - (f0 + (double )j * df)));
+  }
+
+  if (df > 0.0 && maxDev <= tol) {
+    interpolate_uniform_fft_data(numPixels, spec_freqs, fft_length, f0, df,
+                                 fft_pows, fft_interp);
+  } else {
+    interpolate_fft_data_scan(numPixels, spec_freqs, fft_length, fft_freqs,
+                              fft_pows, fft_interp);
+  }
+}
+
+unsigned long int calc_fft_length(int pn_bit_len,
+                                  unsigned long int samps_per_bit)
+{
+  double total_samps = (double )pn_bit_len * (double )samps_per_bit;
   unsigned long int fft_length;
   fft_length = (unsigned long int) floor((total_samps / 2.0)) + 1; // Number of elements in our output DFT arrays
   return fft_length;
 }
 
+// Spacing (cm^-1) of the axis generate_pn_fft and generate_pn_fft_analytic
+// make, which always starts at 0. Same expression as theirs.
+double pn_fft_spacing(int mod_freq, // in MHz
+                      int pn_bit_len)
+{
+  double total_time = (double )pn_bit_len / (double )mod_freq; // in us
+  double speedC = 2.99792458e4; // In cm/usec
+  return 10000.0 * (1.0 / total_time) / speedC; // in cm^-1
+}
+
 
-void generate_pn_fft(int mod_freq, // in MHz
-                     int pn_bit_len,
-                     int pn_bits[1024],
-                     unsigned long int fft_len, // Length of output arrays
-                     double pn_fft_freq[], // Output
-                     double pn_fft_pow[]) // Output
+// Returns 0, or -1 (with zeros in both outputs) if there's no plan for the FFT
+int generate_pn_fft(int mod_freq, // in MHz
+                    int pn_bit_len,
+                    unsigned long int samps_per_bit, // oversampling of the code
+                    int pn_bits[], // pn_bit_len long
+                    unsigned long int fft_len, // Length of output arrays
+                    spec_real pn_fft_freq[], // Output
+                    spec_real pn_fft_pow[]) // Output
 {
   int i;
   unsigned long int j;
@@ -133,29 +403,31 @@ void generate_pn_fft(int mod_freq, // in MHz
 
   double total_time = (double )pn_bit_len * bit_duration; // in us
 
-  unsigned long int itotal_samps = ((unsigned long int )pn_bit_len * isamps_per_bit);
+  unsigned long int itotal_samps = ((unsigned long int )pn_bit_len * samps_per_bit);
 
-  // High-resolution sampling of our PN code
-  double *high_res_pn;
-  high_res_pn = g_malloc0(sizeof(*high_res_pn) * pn_bit_len * isamps_per_bit);
+  // High-resolution sampling of our PN code, this goes straight into the
+  // input buffer of the (cached) plan
+  struct fftPlanEntry *fft = acquire_r2c_plan(itotal_samps);
+  if (fft == NULL) {
+    for (j = 0; j < fft_len; j++) {
+      pn_fft_pow[j] = 0.0;
+      pn_fft_freq[j] = 0.0;
+    }
+    return -1;
+  }
+  spec_real *high_res_pn = fft->in;
 
   unsigned long int idx;
   for (i = 0; i < pn_bit_len; i++) {
-    for (j = 0; j < isamps_per_bit; j++) {
-      idx = j + i*isamps_per_bit;
-      high_res_pn[idx] = (double )pn_bits[i];
+    for (j = 0; j < samps_per_bit; j++) {
+      idx = j + i*samps_per_bit;
+      high_res_pn[idx] = (spec_real )pn_bits[i];
     }
   }
 
-  // Now prepare to do the FFT
-  fftw_complex *pn_fft_out;
-  fftw_plan p_r2c; // FFTW plan
-
-  pn_fft_out = fftw_alloc_complex(sizeof(fftw_complex) * fft_len);
-  p_r2c = fftw_plan_dft_r2c_1d(itotal_samps, high_res_pn, pn_fft_out, FFTW_ESTIMATE); // As we're only running one transform, use FFTW_ESTIMATE
-
   // Run the FFT:
-  fftw_execute(p_r2c);
+  FFTW(execute)(fft->plan);
+  FFTW(complex) *pn_fft_out = fft->out;
 
   double speedC = 2.99792458e4; // In cm/usec
 
@@ -168,10 +440,280 @@ void generate_pn_fft(int mod_freq, // in MHz
                     // 10000 is scaling factor so we don't need a gigantic FFT
   }
 
-  // Free data:
-  fftw_destroy_plan(p_r2c);
-  fftw_free(pn_fft_out);
-  g_free(high_res_pn);
+  release_r2c_plan(fft);
+
+  return 0;
+}
+
+// Magnitude of the spectrum of a single bit held for samps_per_bit samples,
+// evaluated at index k of the full oversampled DFT. This is the discrete
+// (periodic) form of the sinc function, so it is exact for the sampled code.
+double bit_envelope(double k,
+                    int pn_bit_len,
+                    unsigned long int samps_per_bit)
+{
+  if (k == 0.0) {
+    return (double )samps_per_bit; // limit of the ratio below at DC
+  }
+
+  double num = sin(M_PI * k / (double )pn_bit_len);
+  double den = sin(M_PI * k / ((double )pn_bit_len * (double )samps_per_bit));
+  return fabs(num / den);
+}
+
+// Same output as generate_pn_fft, but without building the oversampled code.
+// Holding each bit for samps_per_bit samples makes the sampled signal the
+// bit sequence convolved with a rectangle, so its DFT is the N-point DFT of
+// the bits (repeated every pn_bit_len bins) times the envelope of one bit.
+int generate_pn_fft_analytic(int mod_freq, // in MHz
+                             int pn_bit_len,
+                             unsigned long int samps_per_bit, // oversampling of the code
+                             int pn_bits[], // pn_bit_len long
+                             unsigned long int fft_len, // Length of output arrays
+                             spec_real pn_fft_freq[], // Output
+                             spec_real pn_fft_pow[]) // Output
+{
+  int i;
+  unsigned long int j, k;
+
+  double bit_duration = 1.0/((double ) mod_freq); // How long each bit is in microseconds
+
+  double total_time = (double )pn_bit_len * bit_duration; // in us
+
+  // Only the bits themselves, one sample each
+  unsigned long int bits_fft_len = (unsigned long int )pn_bit_len / 2 + 1;
+  struct fftPlanEntry *fft = acquire_r2c_plan(pn_bit_len);
+  if (fft == NULL) {
+    for (j = 0; j < fft_len; j++) {
+      pn_fft_pow[j] = 0.0;
+      pn_fft_freq[j] = 0.0;
+    }
+    return -1;
+  }
+
+  for (i = 0; i < pn_bit_len; i++) {
+    fft->in[i] = (spec_real )pn_bits[i];
+  }
+
+  FFTW(execute)(fft->plan);
+  FFTW(complex) *bits_fft_out = fft->out;
+
+  double speedC = 2.99792458e4; // In cm/usec
+
+  for (j = 0; j < fft_len; j++) {
+    // The bit DFT is periodic in pn_bit_len, and for real input the upper
+    // half mirrors the lower half, so fold j back into [0, pn_bit_len/2]
+    k = j % (unsigned long int )pn_bit_len;
+    if (k >= bits_fft_len) {
+      k = (unsigned long int )pn_bit_len - k;
+    }
+
+    pn_fft_pow[j] = cabs(bits_fft_out[k]) *
+                    bit_envelope((double )j, pn_bit_len, samps_per_bit) /
+                    (double )fft_len; // The division is to normalize
+    pn_fft_freq[j] = 10000.0 * (((double )j / total_time))/speedC; // Frequency in cm^-1
+  }
+
+  release_r2c_plan(fft);
+
+  return 0;
+}
+
+// Evaluate the magnitude of the bits' DTFT, times the envelope of one bit, at
+// each of the spectrometer frequencies (in cm^-1), with no fft_len sized
+// arrays. On the FFT grid this is what generate_pn_fft gives. Between grid
+// points it's the transform of a single period of the code, which swings
+// between the bins, rather than the line interpolate_fft_data draws between
+// them, so at a pixel it can be well above or below the grid methods (see
+// pn_interp_check). Each pixel costs one Goertzel pass over the bits.
+void evaluate_pn_spectrum(int mod_freq, // in MHz
+                          int pn_bit_len,
+                          unsigned long int samps_per_bit, // oversampling of the code
+                          int pn_bits[], // pn_bit_len long
+                          int numPixels,
+                          spec_real spec_freqs[], // length of numPixels
+                          spec_real pn_interp[]) // output, length of numPixels
+{
+  int i, n;
+
+  double bit_duration = 1.0/((double ) mod_freq); // How long each bit is in microseconds
+  double total_time = (double )pn_bit_len * bit_duration; // in us
+  double speedC = 2.99792458e4; // In cm/usec
+
+  // Normalization and frequency range match generate_pn_fft
+  unsigned long int fft_len = calc_fft_length(pn_bit_len, samps_per_bit);
+  double max_bin = (double )(fft_len - 1);
+
+  double k, omega, coeff, s0, s1, s2;
+
+  for (i = 0; i < numPixels; i++) {
+    // Fractional bin of the oversampled FFT this frequency falls on:
+    k = spec_freqs[i] * total_time * speedC / 10000.0;
+
+    if (k <= 0.0 || k >= max_bin) {
+      // Outside of the FFT, interpolate_fft_data leaves these at 0 as well
+      pn_interp[i] = 0.0;
+      continue;
+    }
+
+    // Goertzel recurrence for the DTFT of the bits at this frequency
+    omega = 2.0 * M_PI * k / (double )pn_bit_len;
+    coeff = 2.0 * cos(omega);
+    s1 = 0.0;
+    s2 = 0.0;
+    for (n = 0; n < pn_bit_len; n++) {
+      s0 = (double )pn_bits[n] + coeff*s1 - s2;
+      s2 = s1;
+      s1 = s0;
+    }
+
+    pn_interp[i] = sqrt(fabs(s1*s1 + s2*s2 - coeff*s1*s2)) *
+                   bit_envelope(k, pn_bit_len, samps_per_bit) /
+                   (double )fft_len;
+  }
 
   return;
 }
+
+// The modulation frequency only sets the length of a bit in time, so it just
+// scales the frequency axis of the PN FFT and leaves the magnitudes alone.
+// Magnitudes are kept here per pn_bit_len, and the axis is rebuilt by a cheap
+// scale whenever a different modulation frequency asks for them.
+// The axis is always evenly spaced from 0, so it's never stored, only its
+// spacing is worked out for each call.
+struct pnFftCacheEntry {
+  int method; // PN_FFT_OVERSAMPLED or PN_FFT_ANALYTIC, only used to compute pow
+  unsigned long int samps_per_bit;
+  unsigned long int fft_len;
+  spec_real *pow; // Independent of modulation frequency
+};
+
+static GHashTable *pn_fft_cache = NULL; // pnFftCacheEntry keyed by pn_bit_len
+static GMutex pn_fft_cache_lock;
+
+void free_pn_fft_cache_entry(gpointer data)
+{
+  struct pnFftCacheEntry *entry = data;
+  g_free(entry->pow);
+  g_free(entry);
+}
+
+void clear_pn_fft_cache()
+{
+  g_mutex_lock(&pn_fft_cache_lock);
+  if (pn_fft_cache) {
+    g_hash_table_destroy(pn_fft_cache);
+    pn_fft_cache = NULL;
+  }
+  g_mutex_unlock(&pn_fft_cache_lock);
+}
+
+// Free the magnitudes kept for one pn_bit_len
+void forget_cached_pn_fft(int pn_bit_len)
+{
+  g_mutex_lock(&pn_fft_cache_lock);
+  if (pn_fft_cache) {
+    g_hash_table_remove(pn_fft_cache, GINT_TO_POINTER(pn_bit_len));
+  }
+  g_mutex_unlock(&pn_fft_cache_lock);
+}
+
+// Entry usable for these settings, or NULL. Call with pn_fft_cache_lock held.
+static struct pnFftCacheEntry *find_cached_pn_fft(int method,
+                                                  int pn_bit_len,
+                                                  unsigned long int samps_per_bit)
+{
+  if (pn_fft_cache == NULL) {
+    pn_fft_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                         NULL, free_pn_fft_cache_entry);
+  }
+
+  struct pnFftCacheEntry *entry = g_hash_table_lookup(pn_fft_cache,
+                                                      GINT_TO_POINTER(pn_bit_len));
+  if (entry == NULL || entry->method != method ||
+      entry->samps_per_bit != samps_per_bit) {
+    return NULL;
+  }
+  return entry;
+}
+
+// Run the transform for a new cache entry, or return NULL if it failed
+static struct pnFftCacheEntry *compute_pn_fft_entry(int method,
+                                                    int mod_freq,
+                                                    int pn_bit_len,
+                                                    unsigned long int samps_per_bit,
+                                                    int pn_bits[])
+{
+  struct pnFftCacheEntry *entry = g_malloc0(sizeof(*entry));
+  entry->method = method;
+  entry->samps_per_bit = samps_per_bit;
+  entry->fft_len = calc_fft_length(pn_bit_len, samps_per_bit);
+  entry->pow = g_malloc0(sizeof(*entry->pow) * entry->fft_len);
+  spec_real *freq = g_malloc0(sizeof(*freq) * entry->fft_len); // Not kept
+  int failed;
+
+  if (method == PN_FFT_ANALYTIC) {
+    failed = generate_pn_fft_analytic(mod_freq, pn_bit_len, samps_per_bit, pn_bits,
+                                      entry->fft_len, freq, entry->pow);
+  } else {
+    failed = generate_pn_fft(mod_freq, pn_bit_len, samps_per_bit, pn_bits,
+                             entry->fft_len, freq, entry->pow);
+  }
+  g_free(freq);
+  if (failed) {
+    // Don't keep the zeros, a later call might have the memory for it
+    free_pn_fft_cache_entry(entry);
+    return NULL;
+  }
+  return entry;
+}
+
+// Interpolate the PN FFT onto the spectrometer frequencies (like calling
+// generate_pn_fft and interpolate_fft_data), reusing the magnitudes from any
+// earlier call with the same pn_bit_len. Only the first call for each
+// pn_bit_len runs a transform, and none of them search the axis. The
+// transform runs without the cache lock, so other code lengths aren't held
+// up by it. Returns 0, or -1 (leaving pn_interp alone) if the transform
+// couldn't be done.
+int interpolate_cached_pn_fft(int method, // PN_FFT_OVERSAMPLED or PN_FFT_ANALYTIC
+                              int mod_freq, // in MHz
+                              int pn_bit_len,
+                              unsigned long int samps_per_bit,
+                              int pn_bits[], // pn_bit_len long
+                              int numPixels,
+                              spec_real spec_freqs[], // length of numPixels
+                              spec_real pn_interp[]) // output, length of numPixels
+{
+  struct pnFftCacheEntry *entry;
+
+  g_mutex_lock(&pn_fft_cache_lock);
+  entry = find_cached_pn_fft(method, pn_bit_len, samps_per_bit);
+  if (entry == NULL) {
+    g_mutex_unlock(&pn_fft_cache_lock);
+    struct pnFftCacheEntry *computed = compute_pn_fft_entry(method, mod_freq, pn_bit_len,
+                                                            samps_per_bit, pn_bits);
+    if (computed == NULL) {
+      return -1;
+    }
+
+    // The cache may have changed (or been cleared) while the lock was free
+    g_mutex_lock(&pn_fft_cache_lock);
+    entry = find_cached_pn_fft(method, pn_bit_len, samps_per_bit);
+    if (entry == NULL) {
+      g_hash_table_replace(pn_fft_cache, GINT_TO_POINTER(pn_bit_len), computed);
+      entry = computed;
+    } else {
+      // Another thread got there first, use its copy
+      free_pn_fft_cache_entry(computed);
+    }
+  }
+
+  // The axis generate_pn_fft would make for this mod_freq, so there's no need
+  // to check it's uniform
+  interpolate_uniform_fft_data(numPixels, spec_freqs, entry->fft_len, 0.0,
+                               pn_fft_spacing(mod_freq, pn_bit_len),
+                               entry->pow, pn_interp);
+
+  g_mutex_unlock(&pn_fft_cache_lock);
+  return 0;
+}
@@ -28,13 +28,14 @@
 #include "acquire_data.h"
 #include "measurement_params.h"
 #include "spectrometer_functions.h"
+#include "fft_functions.h"
+#include "pn_precompute.h"
+#include "acq_session.h"
 
 // Variable to track if we're currently running a scan or not:
 //static int scan_running = 0;
 //static GThread *worker_tid;
 //static struct dataAcqParams *worker_params;
-// This needs to be global so we can cancel an acquisition if we need to
-static GCancellable *cancellable;
 
 // Struct to hold all of the widgets when we start or stop a scan
 typedef struct {
@@ -42,15 +43,26 @@ typedef struct {
   GtkWidget *data_fname_entry;
   GtkWidget *spectrometer_comboBox;
   GtkWidget *num_meas_entry;
+  GtkWidget *target_snr_entry;
+  GtkWidget *snr_band_low_entry;
+  GtkWidget *snr_band_high_entry;
+  GtkWidget *roi_low_entry;
+  GtkWidget *roi_high_entry;
   GtkWidget *pn_bit_length_entry;
   GtkWidget *integration_time_entry;
+  GtkWidget *auto_exposure_check;
   GtkWidget *mod_freq_comboBox;
   GtkWidget *raw_data_check;
   GtkWidget *pn_fft_data_check;
   GtkWidget *final_data_check;
+  GtkWidget *coadd_data_check;
+  GtkWidget *stream_data_check;
   GtkWidget *spectrometer_dialog;
   GtkWidget *progressBar;
   GtkWidget *scan_btn;
+  // Not widgets, but the button handlers need them too:
+  struct acqSession *session; // Open devices, axis and PN responses, kept between scans
+  GCancellable *cancellable; // For the latest scan, so Stop Scan can cancel it
 } userInputWidgets; // Don't love using a typedef here...
                     // Seems to be required to use g_slice_new()
 
@@ -171,15 +183,18 @@ g_print("\n");
 
 
     //========================================================
-    // Initialize our cancellable object:
-    cancellable = g_cancellable_new();
+    // Initialize our cancellable object (the scan keeps its own reference):
+    if (uiWidgets->cancellable) {
+      g_object_unref(uiWidgets->cancellable);
+    }
+    uiWidgets->cancellable = g_cancellable_new();
 
     // Update text on button:
     const char *text = "Stop Scan";
     gtk_button_set_label(button, text);
 
     //========================================================
-    // Prepare to start wafeform generation:
+    // Waveform settings (the generator itself is started along with the scan):
     int pn_bit_len;
     // Get number of bits in our pseudorandom noise sequence
     // entry 0 is 32 and they multiply by power of two after that, this works
@@ -192,9 +207,6 @@ g_print("\n");
     mod_freq_ind = gtk_combo_box_get_active(GTK_COMBO_BOX(uiWidgets->mod_freq_comboBox));
     mod_freq = mod_freqs[mod_freq_ind];
 
-    // Start the waveform generator:
-    start_wvfm_gen(pn_bit_len, mod_freq);
-
     //printf("Number of pn_repetitions = %d\n", pn_repetitions);
 
 
@@ -206,6 +218,16 @@ g_print("\n");
     // Get number of measurements we want to do right now:
     int measurement_reps;
     measurement_reps = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(uiWidgets->num_meas_entry));
+
+    // Stop early once the signal is this far above the noise (0 for off):
+    double target_snr = gtk_spin_button_get_value(GTK_SPIN_BUTTON(uiWidgets->target_snr_entry));
+    // Summed over this band of Raman shifts (cm^-1), in either order:
+    double snr_band_low = gtk_spin_button_get_value(GTK_SPIN_BUTTON(uiWidgets->snr_band_low_entry));
+    double snr_band_high = gtk_spin_button_get_value(GTK_SPIN_BUTTON(uiWidgets->snr_band_high_entry));
+
+    // Only keep pixels in this range of Raman shifts (cm^-1), high of 0 for all:
+    double roi_low = gtk_spin_button_get_value(GTK_SPIN_BUTTON(uiWidgets->roi_low_entry));
+    double roi_high = gtk_spin_button_get_value(GTK_SPIN_BUTTON(uiWidgets->roi_high_entry));
 g_print("Getting file information...\n");
 
     //============================================================
@@ -234,6 +256,8 @@ g_print("Getting file information...\n");
     outputPtr->raw_data = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->raw_data_check));
     outputPtr->pn_fft_data = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->pn_fft_data_check));
     outputPtr->final_data = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->final_data_check));
+    outputPtr->coadd = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->coadd_data_check));
+    outputPtr->stream = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->stream_data_check));
     outputPtr->fname = fname;
     outputPtr->data_dir = data_dir;
 
@@ -243,23 +267,34 @@ g_print("Getting file information...\n");
     GtkWidget *scan_btn = uiWidgets->scan_btn;
     // Set our bar to 0%
     gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progressBar), 0.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progressBar), "Scan Progress...");
 
     // Stuff a struct full of the information needed to take the requested measurement,
     // as well as output the data
     int timeoutInterval = 100; // ms
     struct dataAcqParams *params = g_malloc(sizeof(*params));
 
+    params->session = uiWidgets->session;
     params->spectrometerId = spectrometerId;
     params->integrationTime = integrationTime;
+    params->auto_exposure = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(uiWidgets->auto_exposure_check));
     params->measurement_reps = measurement_reps;
+    params->target_snr = target_snr;
+    params->snr_band_low = MIN(snr_band_low, snr_band_high);
+    params->snr_band_high = MAX(snr_band_low, snr_band_high);
+    params->roi_low = roi_low;
+    params->roi_high = roi_high;
     params->mod_freq = mod_freq;
     params->pn_bit_length = pn_bit_len;
+    params->pn_samps_per_bit = PN_SAMPS_PER_BIT;
     params->outputPtr = outputPtr;
     params->progressBar = progressBar;
     params->timeoutID = 0;
     params->timeoutInterval = timeoutInterval;
-    params->cancellable = cancellable;
+    params->timeoutLoops = 1;
+    params->cancellable = g_object_ref(uiWidgets->cancellable);
     params->scan_btn = scan_btn;
+    params->dutyPermille = -1;
 
     // Start updating the progress bar:
     params->timeoutID = gdk_threads_add_timeout(timeoutInterval, progressBar_timeout_cb,
@@ -276,23 +311,20 @@ g_print("Getting file information...\n");
 
 g_print("About to start async...\n");
 
-    start_data_acq_async(params, cancellable, NULL, NULL);
-
-    // Stop the waveform generator:
-    stop_wvfm_gen();
+    // The waveform generator and spectrometer are set up on their own
+    // threads, and the scan starts once they're both ready
+    start_data_acq_async(params, uiWidgets->cancellable, NULL, NULL);
 
   } else {
     //scan_running = 0;
-    const char *text = "Start Scan";
+    // The scan turns this back into "Start Scan" once its threads are done
+    // with the devices (see scan_done_cb), until then we can't start another
+    const char *text = "Stopping...";
     gtk_button_set_label(button, text);
+    gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
 
-    // Turn off function generator
-    stop_wvfm_gen();
-
-    // Cancel our worker thread
-    g_cancellable_cancel(cancellable);
-    //WAIT FOR SCAN TO FINISH!!!!
-    //clear_data(); // If needed
+    // Cancel our worker thread, it turns off the function generator
+    g_cancellable_cancel(uiWidgets->cancellable);
   }
 
 }
@@ -326,7 +358,7 @@ int main(int    argc,
   // Prepare pointers to builder and window:
   GtkBuilder *builder;
   GtkWidget  *window, *dialog, *spectrometer_comboBox;
-  userInputWidgets *uiWidgets = g_slice_new(userInputWidgets);
+  userInputWidgets *uiWidgets = g_slice_new0(userInputWidgets);
 
   // Load custom CSS:
   GFile  *cssFile = g_file_new_for_path("../css/progressBar.css");
@@ -359,12 +391,20 @@ int main(int    argc,
   uiWidgets->data_fname_entry = GTK_WIDGET(gtk_builder_get_object(builder, "fname_input"));
   uiWidgets->spectrometer_comboBox = GTK_WIDGET(gtk_builder_get_object(builder, "spectrometer_select"));
   uiWidgets->num_meas_entry = GTK_WIDGET(gtk_builder_get_object(builder, "measurement_repetitions"));
+  uiWidgets->target_snr_entry = GTK_WIDGET(gtk_builder_get_object(builder, "target_snr"));
+  uiWidgets->snr_band_low_entry = GTK_WIDGET(gtk_builder_get_object(builder, "snr_band_low"));
+  uiWidgets->snr_band_high_entry = GTK_WIDGET(gtk_builder_get_object(builder, "snr_band_high"));
+  uiWidgets->roi_low_entry = GTK_WIDGET(gtk_builder_get_object(builder, "roi_low"));
+  uiWidgets->roi_high_entry = GTK_WIDGET(gtk_builder_get_object(builder, "roi_high"));
   uiWidgets->pn_bit_length_entry = GTK_WIDGET(gtk_builder_get_object(builder, "pn_bit_length"));
   uiWidgets->integration_time_entry = GTK_WIDGET(gtk_builder_get_object(builder, "integration_time"));
+  uiWidgets->auto_exposure_check = GTK_WIDGET(gtk_builder_get_object(builder, "auto_exposure"));
   uiWidgets->mod_freq_comboBox = GTK_WIDGET(gtk_builder_get_object(builder, "mod_freq_box"));
   uiWidgets->raw_data_check = GTK_WIDGET(gtk_builder_get_object(builder, "raw_data_save"));
   uiWidgets->pn_fft_data_check = GTK_WIDGET(gtk_builder_get_object(builder, "pn_fft_data_save"));
   uiWidgets->final_data_check = GTK_WIDGET(gtk_builder_get_object(builder, "final_data_save"));
+  uiWidgets->coadd_data_check = GTK_WIDGET(gtk_builder_get_object(builder, "coadd_data_save"));
+  uiWidgets->stream_data_check = GTK_WIDGET(gtk_builder_get_object(builder, "stream_data_save"));
   uiWidgets->spectrometer_dialog = GTK_WIDGET(gtk_builder_get_object(builder, "spectrometer_dialog"));
   uiWidgets->progressBar = GTK_WIDGET(gtk_builder_get_object(builder, "scan_progress_bar"));
   uiWidgets->scan_btn = GTK_WIDGET(gtk_builder_get_object(builder, "scan_button"));
@@ -410,6 +450,10 @@ int main(int    argc,
     gtk_widget_show(dialog);
   }
 
+  //=======================================================
+  // Load saved FFTW plans so PN transforms don't need to be re-planned:
+  fft_plans_init(FFTW_WISDOM_FILE);
+
   //=======================================================
   // initialize spectrometer API:
   initialize_spectrometer_api();
@@ -436,6 +480,16 @@ int main(int    argc,
     gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(spectrometer_comboBox), id, nameBuf);
   }
 
+  // Start computing the PN responses for every code length and modulation
+  // frequency in the background while the user fills in the form. This needs
+  // each spectrometer's calibration, so open them all (the last one stays open,
+  // and the session keeps its axis for the first scan).
+  uiWidgets->session = acq_session_new();
+  for (i = 0; i < numberOfSpectrometers; i++) {
+    int numPixels = acq_session_use_spectrometer(uiWidgets->session, spectrometerIds[i]);
+    pn_precompute_start(numPixels, uiWidgets->session->frequencies, PN_SAMPS_PER_BIT);
+  }
+
   g_free(spectrometerIds);
   // END OF INITIALIZATION
 
@@ -449,11 +503,17 @@ int main(int    argc,
   // Run the main loop:
   gtk_main();
 
+  pn_precompute_stop();
+  acq_session_free(uiWidgets->session); // Closes the spectrometer
+  if (uiWidgets->cancellable) {
+    g_object_unref(uiWidgets->cancellable);
+  }
   g_slice_free(userInputWidgets, uiWidgets);
 
-  close_spectrometer();
   shutdown_spectrometer_api(); // frees memory for spectrometers
-  stop_wvfm_gen(); // Turns off output from the generator (in case it is still running)
+  close_wvfm_gen(); // Turns off output from the generator (in case it is still running)
+  clear_pn_fft_cache();
+  fft_plans_shutdown(); // Saves FFTW wisdom for next time
 
   return 0;
 }
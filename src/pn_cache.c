@@ -0,0 +1,135 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Binary files holding the PN response already interpolated onto a
+// spectrometer's frequency axis, one per combination of settings. A scan
+// memory-maps a matching file instead of computing the response, and writes
+// a new one when there isn't a match. Files are:
+//   struct pnCacheFileHeader, then numPixels spec_reals
+// in the native byte order, as they only ever need to be read on this PC.
+
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "pn_cache.h"
+
+#define PN_CACHE_MAGIC "PNRESP2" // Change the number if the layout changes
+
+struct pnCacheFileHeader {
+  char magic[8];
+  gint32 pn_bit_len;
+  gint32 mod_freq;
+  gint32 method;
+  gint32 numPixels;
+  guint64 samps_per_bit;
+  guint64 axis_hash;
+  gint32 value_size; // sizeof(spec_real), single and double builds differ
+  gint32 reserved;
+}; // 48 bytes, so the values that follow stay 8-byte aligned
+
+// 64-bit FNV-1a hash of the frequency axis, so any change in calibration (or
+// laser wavelength) gets its own file
+guint64 pn_cache_hash_axis(int numPixels, const spec_real axis[])
+{
+  const guint8 *bytes = (const guint8 *)axis;
+  gsize i, len = (gsize )numPixels * sizeof(*axis);
+  guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+
+  for (i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= G_GUINT64_CONSTANT(1099511628211);
+  }
+  return hash;
+}
+
+gchar *pn_cache_filename(const struct pnCacheKey *key)
+{
+  gchar *fname, *path;
+  fname = g_strdup_printf("pn_%d_%dMHz_m%d_s%lu_f%d_%016" G_GINT64_MODIFIER "x.bin",
+                          key->pn_bit_len, key->mod_freq, key->method,
+                          key->samps_per_bit, (int )(8 * sizeof(spec_real)),
+                          key->axis_hash);
+  path = g_build_filename(PN_CACHE_DIR, fname, NULL);
+  g_free(fname);
+  return path;
+}
+
+void fill_cache_header(struct pnCacheFileHeader *header,
+                       const struct pnCacheKey *key)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, PN_CACHE_MAGIC, sizeof(PN_CACHE_MAGIC));
+  header->pn_bit_len = key->pn_bit_len;
+  header->mod_freq = key->mod_freq;
+  header->method = key->method;
+  header->numPixels = key->numPixels;
+  header->samps_per_bit = key->samps_per_bit;
+  header->axis_hash = key->axis_hash;
+  header->value_size = sizeof(spec_real);
+}
+
+// Returns the mapped file and points values at the cached response, or NULL
+// if there's no (valid) file for this key. Release with g_mapped_file_unref()
+// once values is no longer needed.
+GMappedFile *pn_cache_load(const struct pnCacheKey *key,
+                           const spec_real **values)
+{
+  gchar *path = pn_cache_filename(key);
+  GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+
+  if (file == NULL) {
+    return NULL; // Not cached yet
+  }
+
+  struct pnCacheFileHeader expected;
+  fill_cache_header(&expected, key);
+
+  gsize expectedLen = sizeof(expected) + (gsize )key->numPixels * sizeof(spec_real);
+  const gchar *contents = g_mapped_file_get_contents(file);
+
+  if (g_mapped_file_get_length(file) != expectedLen ||
+      memcmp(contents, &expected, sizeof(expected)) != 0) {
+    // Truncated, from an older layout, or a hash collision; recompute
+    g_mapped_file_unref(file);
+    return NULL;
+  }
+
+  *values = (const spec_real *)(contents + sizeof(expected));
+  return file;
+}
+
+void pn_cache_store(const struct pnCacheKey *key,
+                    const spec_real values[])
+{
+  GError *error = NULL;
+  gsize valuesLen = (gsize )key->numPixels * sizeof(*values);
+  gchar *buf = g_malloc(sizeof(struct pnCacheFileHeader) + valuesLen);
+
+  fill_cache_header((struct pnCacheFileHeader *)buf, key);
+  memcpy(buf + sizeof(struct pnCacheFileHeader), values, valuesLen);
+
+  g_mkdir_with_parents(PN_CACHE_DIR, 0755);
+  gchar *path = pn_cache_filename(key);
+  // Writes to a temporary file and renames it, so a reader never sees half a file
+  if (!g_file_set_contents(path, buf, sizeof(struct pnCacheFileHeader) + valuesLen,
+                           &error)) {
+    g_print("Unable to cache PN response: %s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(path);
+  g_free(buf);
+}
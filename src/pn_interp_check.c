@@ -0,0 +1,300 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+// Check that interpolate_uniform_fft_data (the arithmetic bracket lookup used
+// on the generated axis, with pn_fft_spacing) gives the same PN response as
+// the bracket search in interpolate_fft_data_scan, on the same spectrometer
+// axis pn_report uses. Also checks that interpolate_fft_data falls back to the
+// search for an axis that isn't evenly spaced, and that PN_FFT_DIRECT matches the FFT on its grid.
+// Returns non-zero if any of those don't hold, so it can run under ctest.
+//
+// Between grid points PN_FFT_DIRECT is a different quantity from the
+// interpolated FFT, so it's only reported: the spread of its ratio to the
+// interpolated response over the pixels.
+//
+// Usage: pn_interp_check [mod_freq (MHz)] [first wavelength (nm)] [last wavelength (nm)] [pixels]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gtk/gtk.h>
+
+#include "fft_functions.h"
+#include "measurement_params.h"
+#include "pn_sequence.h"
+
+// The search uses an FFT point within this (relative) distance of a pixel as
+// is, instead of interpolating. Same as the tolerance in
+// interpolate_fft_data_scan.
+#define SCAN_SNAP_TOLERANCE 1e-4
+
+// Where the search interpolates, the two only differ by rounding. The search
+// works from the axis as stored, which in single precision is off by up to
+// a few hundredths of a step on long axes, so allow more for that.
+#define CHECK_TOLERANCE (1e-6 + 1e4 * SPEC_REAL_EPSILON) // Relative to the largest value
+
+// Larger FFT axes are checked at a lower oversampling, to keep memory down
+#define CHECK_MAX_FFT_LEN (1UL << 21)
+
+// Pixels the FFT axis doesn't cover are left alone by both, this marks them
+#define UNTOUCHED -1.0
+
+// Pixels where the interpolated response is below this (relative to its
+// largest value) are left out of the PN_FFT_DIRECT ratios
+#define RATIO_FLOOR 1e-3
+
+void fill_untouched(int numPixels, spec_real values[])
+{
+  int i;
+  for (i = 0; i < numPixels; i++) {
+    values[i] = UNTOUCHED;
+  }
+}
+
+// How far the search's value at freq can be from the interpolated one. Zero
+// unless there's an FFT point close enough for the search to use instead,
+// then it's the spread of the points it could have picked.
+double snap_allowance(double freq,
+                      unsigned long int fft_length,
+                      double df,
+                      const spec_real fft_pows[])
+{
+  double window = SCAN_SNAP_TOLERANCE * fabs(freq);
+  double x = freq / df; // Fractional index, the axis starts at 0
+  double nearest = fabs(x - round(x)) * df;
+  if (nearest >= window) {
+    return 0.0;
+  }
+
+  long j, first = (long )floor((freq - window) / df);
+  long last = (long )ceil((freq + window) / df);
+  first = MAX(first, 0);
+  last = MIN(last, (long )fft_length - 1);
+  double lo = fft_pows[first], hi = fft_pows[first];
+  for (j = first; j <= last; j++) {
+    lo = fmin(lo, fft_pows[j]);
+    hi = fmax(hi, fft_pows[j]);
+  }
+  return hi - lo;
+}
+
+// Largest difference between the search (scanned) and the uniform lookup
+// beyond what snapping allows, relative to the largest value, or -1 if they
+// don't leave the same pixels untouched. With df of 0, no snapping is allowed.
+double compare_responses(int numPixels,
+                         const spec_real frequencies[],
+                         const spec_real scanned[],
+                         const spec_real uniform[],
+                         unsigned long int fft_length,
+                         double df,
+                         const spec_real fft_pows[])
+{
+  int i;
+  double maxValue = 0.0, maxDev = 0.0, dev;
+  for (i = 0; i < numPixels; i++) {
+    if ((scanned[i] == UNTOUCHED) != (uniform[i] == UNTOUCHED)) {
+      return -1.0;
+    }
+    if (scanned[i] == UNTOUCHED) {
+      continue;
+    }
+    maxValue = fmax(maxValue, fabs(scanned[i]));
+    dev = fabs((double )scanned[i] - uniform[i]);
+    if (df > 0.0) {
+      dev = fmax(0.0, dev - snap_allowance(frequencies[i], fft_length, df, fft_pows));
+    }
+    maxDev = fmax(maxDev, dev);
+  }
+  return (maxValue > 0.0) ? maxDev / maxValue : maxDev;
+}
+
+// Largest difference between PN_FFT_DIRECT and the FFT on the first count
+// grid points after 0, relative to the largest FFT value there. Low bins, as
+// higher up a single precision frequency can't land on a grid point (it's off
+// by up to the bin number times SPEC_REAL_EPSILON of a bin).
+double compare_direct_on_grid(int mod_freq,
+                              int pn_bit_len,
+                              unsigned long int samps,
+                              int pn_bits[],
+                              int count,
+                              unsigned long int fft_len,
+                              double df,
+                              const spec_real fft_pows[])
+{
+  int i;
+  spec_real *gridFreqs = g_malloc0(sizeof(*gridFreqs) * count);
+  spec_real *direct = g_malloc0(sizeof(*direct) * count);
+  double maxValue = 0.0, maxDev = 0.0;
+
+  count = MIN(count, (int )fft_len - 2);
+  for (i = 0; i < count; i++) {
+    gridFreqs[i] = (double )(i + 1) * df;
+  }
+  evaluate_pn_spectrum(mod_freq, pn_bit_len, samps, pn_bits, count, gridFreqs,
+                       direct);
+  for (i = 0; i < count; i++) {
+    maxValue = fmax(maxValue, fabs(fft_pows[i + 1]));
+    maxDev = fmax(maxDev, fabs((double )direct[i] - fft_pows[i + 1]));
+  }
+
+  g_free(gridFreqs);
+  g_free(direct);
+  return (maxValue > 0.0) ? maxDev / maxValue : maxDev;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Smallest, median and largest ratio of PN_FFT_DIRECT to the interpolated
+// response over the pixels where the latter isn't close to 0
+void direct_ratio_spread(int numPixels,
+                         const spec_real direct[],
+                         const spec_real interpolated[],
+                         double spread[3]) // output
+{
+  int i, count = 0;
+  double maxValue = 0.0;
+  double *ratios = g_malloc0(sizeof(*ratios) * numPixels);
+
+  for (i = 0; i < numPixels; i++) {
+    if (interpolated[i] != UNTOUCHED) {
+      maxValue = fmax(maxValue, fabs(interpolated[i]));
+    }
+  }
+  for (i = 0; i < numPixels; i++) {
+    if (interpolated[i] != UNTOUCHED && interpolated[i] > RATIO_FLOOR * maxValue) {
+      ratios[count++] = (double )direct[i] / interpolated[i];
+    }
+  }
+
+  if (count == 0) {
+    spread[0] = spread[1] = spread[2] = 0.0;
+  } else {
+    qsort(ratios, count, sizeof(*ratios), compare_doubles);
+    spread[0] = ratios[0];
+    spread[1] = ratios[count / 2];
+    spread[2] = ratios[count - 1];
+  }
+  g_free(ratios);
+}
+
+int main(int argc, char **argv)
+{
+  int i, j;
+  int failures = 0;
+  int mod_freq = (argc > 1) ? atoi(argv[1]) : mod_freqs[1];
+  double firstWavelength = (argc > 2) ? atof(argv[2]) : 640.0; // nm
+  double lastWavelength = (argc > 3) ? atof(argv[3]) : 790.0; // nm
+  int numPixels = (argc > 4) ? atoi(argv[4]) : 1044;
+
+  if (mod_freq <= 0 || numPixels < 2 || lastWavelength <= firstWavelength) {
+    fprintf(stderr, "Usage: %s [mod_freq (MHz)] [first wavelength (nm)] [last wavelength (nm)] [pixels]\n", argv[0]);
+    return 1;
+  }
+
+  // Same conversion to wavenumbers as in data_acq
+  spec_real *frequencies = g_malloc0(sizeof(*frequencies) * numPixels);
+  for (i = 0; i < numPixels; i++) {
+    double wavelength = firstWavelength +
+      (lastWavelength - firstWavelength) * (double )i / (double )(numPixels - 1);
+    frequencies[i] = 1.0e7*((1.0 / LASER_WAVELENGTH) - (1.0 / wavelength));
+  }
+
+  spec_real *scanned = g_malloc0(sizeof(*scanned) * numPixels);
+  spec_real *uniform = g_malloc0(sizeof(*uniform) * numPixels);
+  spec_real *direct = g_malloc0(sizeof(*direct) * numPixels);
+
+  fft_plans_init(NULL);
+
+  printf("%8s %10s %12s %12s %12s   %s\n", "bits", "samps/bit", "uniform",
+         "non-uniform", "direct@grid", "direct/interpolated (min median max)");
+  for (i = 0; i < PN_CODE_LENGTH_OPTS; i++) {
+    int pn_bit_len = pn_code_lengths[i];
+    int *pn_bits = get_pn_bits(pn_bit_len);
+    unsigned long int samps = PN_SAMPS_PER_BIT;
+
+    if (pn_bits == NULL) {
+      continue;
+    }
+    while (samps > 1 && calc_fft_length(pn_bit_len, samps) > CHECK_MAX_FFT_LEN) {
+      samps /= 2;
+    }
+
+    unsigned long int fft_len = calc_fft_length(pn_bit_len, samps);
+    spec_real *pn_fft_freq = g_malloc0(sizeof(*pn_fft_freq) * fft_len);
+    spec_real *pn_fft_pow = g_malloc0(sizeof(*pn_fft_pow) * fft_len);
+    generate_pn_fft_analytic(mod_freq, pn_bit_len, samps, pn_bits, fft_len,
+                             pn_fft_freq, pn_fft_pow);
+
+    // The uniform lookup against the search, on the axis as generated
+    fill_untouched(numPixels, scanned);
+    fill_untouched(numPixels, uniform);
+    interpolate_fft_data_scan(numPixels, frequencies, fft_len, pn_fft_freq,
+                              pn_fft_pow, scanned);
+    double df = pn_fft_spacing(mod_freq, pn_bit_len);
+    interpolate_uniform_fft_data(numPixels, frequencies, fft_len, 0.0, df,
+                                 pn_fft_pow, uniform);
+    double uniformDev = compare_responses(numPixels, frequencies, scanned, uniform,
+                                          fft_len, df, pn_fft_pow);
+
+    // PN_FFT_DIRECT on the grid, then at the pixels against the interpolation
+    double directDev = compare_direct_on_grid(mod_freq, pn_bit_len, samps, pn_bits,
+                                              numPixels, fft_len, df, pn_fft_pow);
+    double spread[3];
+    evaluate_pn_spectrum(mod_freq, pn_bit_len, samps, pn_bits, numPixels,
+                         frequencies, direct);
+    direct_ratio_spread(numPixels, direct, uniform, spread);
+
+    // Stretch the upper end of the axis by up to 10%, interpolate_fft_data
+    // has to notice and use the search, which should then match exactly
+    for (j = 1; j < fft_len; j++) {
+      pn_fft_freq[j] *= 1.0 + 0.1 * (double )j / (double )(fft_len - 1);
+    }
+    fill_untouched(numPixels, scanned);
+    fill_untouched(numPixels, uniform);
+    interpolate_fft_data_scan(numPixels, frequencies, fft_len, pn_fft_freq,
+                              pn_fft_pow, scanned);
+    interpolate_fft_data(numPixels, frequencies, fft_len, pn_fft_freq,
+                         pn_fft_pow, uniform);
+    double fallbackDev = compare_responses(numPixels, frequencies, scanned, uniform,
+                                           fft_len, 0.0, pn_fft_pow);
+
+    int failed = (uniformDev < 0.0 || uniformDev > CHECK_TOLERANCE ||
+                  fallbackDev != 0.0 || directDev > CHECK_TOLERANCE);
+    printf("%8d %10lu %12.3e %12.3e %12.3e   %.3f %.3f %.3f%s\n", pn_bit_len, samps,
+           uniformDev, fallbackDev, directDev, spread[0], spread[1], spread[2],
+           failed ? "  FAILED" : "");
+    failures += failed;
+
+    g_free(pn_fft_freq);
+    g_free(pn_fft_pow);
+    g_free(pn_bits);
+  }
+
+  fft_plans_shutdown();
+  g_free(frequencies);
+  g_free(scanned);
+  g_free(uniform);
+  g_free(direct);
+
+  if (failures > 0) {
+    printf("%d code length(s) out of tolerance (%.0e)\n", failures, CHECK_TOLERANCE);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,282 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Computes the PN response at the spectrometer pixels for every PN code length
+// and modulation frequency on a low priority background thread at startup, so
+// by the time a scan starts its response is (usually) already in the disk
+// cache. Scans go through pn_response_acquire(), which waits for a response
+// that's being computed, and computes it right away if the background thread
+// hasn't got to it yet.
+
+#include <gtk/gtk.h>
+#ifdef G_OS_WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "pn_precompute.h"
+#include "fft_functions.h"
+#include "measurement_params.h"
+#include "pn_sequence.h"
+
+// States of a response, 0 means nobody has asked for it
+#define PN_JOB_QUEUED  1
+#define PN_JOB_RUNNING 2 // in the background or by a scan
+#define PN_JOB_DONE    3
+
+struct pnPrecomputeJob {
+  struct pnCacheKey key;
+  GBytes *spec_freqs; // Shared by all jobs for a spectrometer
+  int last_for_code; // No more jobs for this key.pn_bit_len after this one
+};
+
+static GThreadPool *precompute_pool = NULL;
+static GHashTable *job_states = NULL; // PN_JOB_* keyed by cache file name
+static GMutex job_lock;
+static GCond job_changed;
+static gint stopping = 0;
+
+// Fill pn_interp with the PN response for key, from scratch. Returns -1 (and
+// fills it with zeros) if there's no PN code or its FFT couldn't be done,
+// which mustn't go in the disk cache.
+int pn_response_compute(const struct pnCacheKey *key,
+                        spec_real spec_freqs[], // key->numPixels long
+                        spec_real pn_interp[]) // output, key->numPixels long
+{
+  int i, failed = 0;
+  int *pn_bits = get_pn_bits(key->pn_bit_len);
+  if (pn_bits == NULL) {
+    g_print("No PN code of length %d\n", key->pn_bit_len);
+    for (i = 0; i < key->numPixels; i++) {
+      pn_interp[i] = 0.0;
+    }
+    return -1;
+  }
+
+  if (key->method == PN_FFT_DIRECT) {
+    // Evaluate the PN spectrum right at the spectrometer frequencies, this
+    // skips the full FFT and the interpolation step
+    evaluate_pn_spectrum(key->mod_freq, key->pn_bit_len, key->samps_per_bit,
+                         pn_bits, key->numPixels, spec_freqs, pn_interp);
+  } else {
+    // The FFT of the PN code for this bit length (kept in memory, so other
+    // modulation frequencies can reuse it), interpolated to the same
+    // frequencies as the data from the spectrometer.
+    failed = interpolate_cached_pn_fft(key->method, key->mod_freq, key->pn_bit_len,
+                                       key->samps_per_bit, pn_bits, key->numPixels,
+                                       spec_freqs, pn_interp);
+    if (failed) {
+      g_print("No FFT of the %d bit PN code\n", key->pn_bit_len);
+      for (i = 0; i < key->numPixels; i++) {
+        pn_interp[i] = 0.0;
+      }
+    }
+  }
+
+  g_free(pn_bits);
+  return (failed) ? -1 : 0;
+}
+
+// Call with job_lock held
+int get_job_state(const gchar *name)
+{
+  if (job_states == NULL) {
+    return 0;
+  }
+  return GPOINTER_TO_INT(g_hash_table_lookup(job_states, name));
+}
+
+// Call with job_lock held
+void set_job_state(const gchar *name, int state)
+{
+  if (job_states) {
+    g_hash_table_replace(job_states, g_strdup(name), GINT_TO_POINTER(state));
+    g_cond_broadcast(&job_changed);
+  }
+}
+
+void precompute_job(gpointer data, gpointer user_data)
+{
+  struct pnPrecomputeJob *job = data;
+  gchar *name = pn_cache_filename(&job->key);
+  int claimed = 0;
+
+  // Only ever one of these threads, keep it out of the way of the UI and scans
+#ifdef G_OS_WIN32
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+  // Linux keeps a nice value for each thread, so this is only this one
+  setpriority(PRIO_PROCESS, (id_t )syscall(SYS_gettid), 19);
+#endif
+  // Elsewhere the nice value is for the whole process, so it runs at normal
+  // priority
+
+  g_mutex_lock(&job_lock);
+  if (!g_atomic_int_get(&stopping) && get_job_state(name) == PN_JOB_QUEUED) {
+    set_job_state(name, PN_JOB_RUNNING);
+    claimed = 1;
+  }
+  g_mutex_unlock(&job_lock);
+
+  if (claimed) {
+    const spec_real *cached;
+    GMappedFile *file = pn_cache_load(&job->key, &cached);
+
+    if (file) {
+      g_mapped_file_unref(file); // Already done by an earlier run
+    } else {
+      spec_real *values = g_malloc0(sizeof(*values) * job->key.numPixels);
+      // Only ever read from, so it's safe to drop the const here
+      if (pn_response_compute(&job->key,
+                              (spec_real *)g_bytes_get_data(job->spec_freqs, NULL),
+                              values) == 0) {
+        pn_cache_store(&job->key, values);
+      }
+      g_free(values);
+    }
+
+    g_mutex_lock(&job_lock);
+    set_job_state(name, PN_JOB_DONE);
+    g_mutex_unlock(&job_lock);
+  }
+
+  if (job->last_for_code) {
+    // Everything for this code is on disk now, so don't hold on to its FFT
+    forget_cached_pn_fft(job->key.pn_bit_len);
+  }
+
+  g_bytes_unref(job->spec_freqs);
+  g_free(name);
+  g_free(job);
+}
+
+// Queue up every PN code length and modulation frequency for a spectrometer
+// with these pixel frequencies, shortest codes first. Can be called once for
+// each spectrometer.
+void pn_precompute_start(int numPixels,
+                         const spec_real spec_freqs[],
+                         unsigned long int samps_per_bit)
+{
+  int i, j;
+  GBytes *freqs = g_bytes_new(spec_freqs, sizeof(*spec_freqs) * numPixels);
+  guint64 axis_hash = pn_cache_hash_axis(numPixels, spec_freqs);
+
+  g_mutex_lock(&job_lock);
+  if (precompute_pool == NULL) {
+    job_states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    precompute_pool = g_thread_pool_new(precompute_job, NULL, 1, TRUE, NULL);
+  }
+
+  for (i = 0; i < PN_CODE_LENGTH_OPTS; i++) {
+    for (j = 0; j < MODULATION_OPTS; j++) {
+      struct pnPrecomputeJob *job = g_malloc0(sizeof(*job));
+      job->key.pn_bit_len = pn_code_lengths[i];
+      job->key.mod_freq = mod_freqs[j];
+      job->key.method = PN_FFT_METHOD;
+      job->key.numPixels = numPixels;
+      job->key.samps_per_bit = samps_per_bit;
+      job->key.axis_hash = axis_hash;
+      job->spec_freqs = g_bytes_ref(freqs);
+      job->last_for_code = (j == MODULATION_OPTS - 1);
+
+      gchar *name = pn_cache_filename(&job->key);
+      if (get_job_state(name) == 0) {
+        set_job_state(name, PN_JOB_QUEUED);
+        g_thread_pool_push(precompute_pool, job, NULL);
+      } else { // Two spectrometers with the same calibration
+        g_bytes_unref(job->spec_freqs);
+        g_free(job);
+      }
+      g_free(name);
+    }
+  }
+  g_mutex_unlock(&job_lock);
+
+  g_bytes_unref(freqs);
+}
+
+// Skip anything still queued and wait for the running job to finish
+void pn_precompute_stop()
+{
+  g_atomic_int_set(&stopping, 1);
+  if (precompute_pool) {
+    g_thread_pool_free(precompute_pool, FALSE, TRUE);
+    precompute_pool = NULL;
+  }
+
+  g_mutex_lock(&job_lock);
+  if (job_states) {
+    g_hash_table_destroy(job_states);
+    job_states = NULL;
+    g_cond_broadcast(&job_changed);
+  }
+  g_mutex_unlock(&job_lock);
+}
+
+// Get the PN response for key, from the disk cache if it's there (waiting on
+// the background thread if it's working on it) and computing it into buf
+// otherwise. Returns a pointer into *mapped (unref when done) if it was cached,
+// buf if not, and NULL if it couldn't be computed.
+spec_real *pn_response_acquire(const struct pnCacheKey *key,
+                               spec_real spec_freqs[], // key->numPixels long
+                               spec_real buf[], // key->numPixels long
+                               GMappedFile **mapped)
+{
+  const spec_real *cached = NULL;
+  gchar *name = pn_cache_filename(key);
+  int claimed = 0;
+
+  *mapped = NULL;
+
+  g_mutex_lock(&job_lock);
+  while (get_job_state(name) == PN_JOB_RUNNING) {
+    g_cond_wait(&job_changed, &job_lock);
+  }
+  if (get_job_state(name) == PN_JOB_QUEUED) {
+    // Don't wait behind the rest of the queue, the background thread will
+    // skip it when it comes up
+    set_job_state(name, PN_JOB_RUNNING);
+    claimed = 1;
+  }
+  g_mutex_unlock(&job_lock);
+
+  int failed = 0;
+  *mapped = pn_cache_load(key, &cached);
+  if (*mapped == NULL) {
+    // Save it so next time we can skip all of the above (unless it's only
+    // zeros because it failed, then the next scan tries again):
+    if (pn_response_compute(key, spec_freqs, buf) == 0) {
+      pn_cache_store(key, buf);
+    } else {
+      failed = 1;
+    }
+  }
+
+  if (claimed) {
+    g_mutex_lock(&job_lock);
+    set_job_state(name, PN_JOB_DONE);
+    g_mutex_unlock(&job_lock);
+  }
+  g_free(name);
+
+  if (failed) {
+    return NULL;
+  }
+  // Only ever read from, so it's safe to drop the const here
+  return (*mapped) ? (spec_real *)cached : buf;
+}
@@ -0,0 +1,218 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Program to help choose PN_SAMPS_PER_BIT (in measurement_params.h). For each
+// PN code length it prints how far the PN response at the spectrometer pixels
+// (pn_interp_fft in data_acq) is from a high oversampling reference, as well as
+// how long it took and an estimate of the memory it needed, for a range of
+// oversampling factors. Uses the PN_FFT_METHOD the application is built with.
+//
+// Usage: pn_report [mod_freq (MHz)] [first wavelength (nm)] [last wavelength (nm)] [pixels]
+// The wavelengths are spread evenly over the pixels, the defaults are close to
+// our QE-Pro.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gtk/gtk.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "fft_functions.h"
+#include "measurement_params.h"
+#include "pn_sequence.h"
+
+#define REFERENCE_SAMPS_PER_BIT 4096
+// Long codes use fewer samples per bit for an FFT reference, so that it stays
+// under this length (at 4096 a 65536 bit code would need about 2 GB)
+#define REFERENCE_MAX_FFT_LEN (1UL << 23)
+
+static const unsigned long int test_samps_per_bit[] = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+// Working memory (in bytes) a method should need on top of its numPixels
+// output, worked out from the buffer sizes rather than measured
+gsize pn_method_memory(int method, int pn_bit_len, unsigned long int samps_per_bit)
+{
+  gsize fft_len = calc_fft_length(pn_bit_len, samps_per_bit);
+  gsize grid = 2 * fft_len * sizeof(spec_real); // pn_fft_freq and pn_fft_pow
+
+  if (method == PN_FFT_OVERSAMPLED) {
+    // Sampled code and its transform, plus the grid
+    return (gsize )pn_bit_len * samps_per_bit * sizeof(spec_real) +
+           fft_len * 2 * sizeof(spec_real) + grid;
+  } else if (method == PN_FFT_ANALYTIC) {
+    // Only the bits and their transform, plus the grid
+    return (gsize )pn_bit_len * sizeof(spec_real) +
+           ((gsize )pn_bit_len / 2 + 1) * 2 * sizeof(spec_real) + grid;
+  }
+  return 0; // PN_FFT_DIRECT works in place
+}
+
+// Compute the PN response like data_acq would (without any caching) and
+// return how long it took in microseconds
+gint64 compute_pn_response(int method,
+                           int mod_freq,
+                           int pn_bit_len,
+                           unsigned long int samps_per_bit,
+                           int pn_bits[],
+                           int numPixels,
+                           spec_real spec_freqs[],
+                           spec_real pn_interp[])
+{
+  gint64 start = g_get_monotonic_time();
+
+  if (method == PN_FFT_DIRECT) {
+    evaluate_pn_spectrum(mod_freq, pn_bit_len, samps_per_bit, pn_bits,
+                         numPixels, spec_freqs, pn_interp);
+  } else {
+    unsigned long int fft_len = calc_fft_length(pn_bit_len, samps_per_bit);
+    spec_real *pn_fft_freq = g_malloc0(sizeof(*pn_fft_freq) * fft_len);
+    spec_real *pn_fft_pow = g_malloc0(sizeof(*pn_fft_pow) * fft_len);
+
+    if (method == PN_FFT_ANALYTIC) {
+      generate_pn_fft_analytic(mod_freq, pn_bit_len, samps_per_bit, pn_bits,
+                               fft_len, pn_fft_freq, pn_fft_pow);
+    } else {
+      generate_pn_fft(mod_freq, pn_bit_len, samps_per_bit, pn_bits,
+                      fft_len, pn_fft_freq, pn_fft_pow);
+    }
+    // The axis is known to be even, so don't pay for checking it
+    interpolate_uniform_fft_data(numPixels, spec_freqs, fft_len, 0.0,
+                                 pn_fft_spacing(mod_freq, pn_bit_len),
+                                 pn_fft_pow, pn_interp);
+
+    g_free(pn_fft_freq);
+    g_free(pn_fft_pow);
+  }
+
+  return g_get_monotonic_time() - start;
+}
+
+int main(int argc, char **argv)
+{
+  int i, j, k;
+  int method = PN_FFT_METHOD;
+  int mod_freq = (argc > 1) ? atoi(argv[1]) : mod_freqs[1];
+  double firstWavelength = (argc > 2) ? atof(argv[2]) : 640.0; // nm
+  double lastWavelength = (argc > 3) ? atof(argv[3]) : 790.0; // nm
+  int numPixels = (argc > 4) ? atoi(argv[4]) : 1044;
+
+  if (mod_freq <= 0 || numPixels < 2 || lastWavelength <= firstWavelength) {
+    fprintf(stderr, "Usage: %s [mod_freq (MHz)] [first wavelength (nm)] [last wavelength (nm)] [pixels]\n", argv[0]);
+    return 1;
+  }
+
+  // Same conversion to wavenumbers as in data_acq
+  spec_real *frequencies = g_malloc0(sizeof(*frequencies) * numPixels);
+  for (i = 0; i < numPixels; i++) {
+    double wavelength = firstWavelength +
+      (lastWavelength - firstWavelength) * (double )i / (double )(numPixels - 1);
+    frequencies[i] = 1.0e7*((1.0 / LASER_WAVELENGTH) - (1.0 / wavelength));
+  }
+
+  spec_real *reference = g_malloc0(sizeof(*reference) * numPixels);
+  spec_real *pn_interp = g_malloc0(sizeof(*pn_interp) * numPixels);
+
+  fft_plans_init(FFTW_WISDOM_FILE);
+
+  const char *methodNames[] = {"PN_FFT_OVERSAMPLED", "PN_FFT_ANALYTIC", "PN_FFT_DIRECT"};
+  printf("PN response with %s at %d MHz on %d pixels (%.1f to %.1f cm^-1)\n",
+         methodNames[method], mod_freq, numPixels, frequencies[0],
+         frequencies[numPixels - 1]);
+  printf("Deviations are from %d samples per bit (fewer for long codes), relative to\n"
+         "the largest reference value. Memory is estimated from the buffer sizes.\n\n",
+         REFERENCE_SAMPS_PER_BIT);
+  printf("%8s %10s %12s %12s %10s %16s\n", "bits", "samps/bit", "max dev",
+         "rms dev", "time (ms)", "est. memory (kB)");
+
+  for (i = 0; i < PN_CODE_LENGTH_OPTS; i++) {
+    int pn_bit_len = pn_code_lengths[i];
+    int *pn_bits = get_pn_bits(pn_bit_len);
+
+    if (pn_bits == NULL) {
+      continue;
+    }
+
+    // The oversampled and analytic FFTs are identical, so use the (much)
+    // cheaper one for the reference
+    int refMethod = (method == PN_FFT_OVERSAMPLED) ? PN_FFT_ANALYTIC : method;
+    unsigned long int refSamps = REFERENCE_SAMPS_PER_BIT;
+    while (refMethod != PN_FFT_DIRECT && refSamps > 1 &&
+           calc_fft_length(pn_bit_len, refSamps) > REFERENCE_MAX_FFT_LEN) {
+      refSamps /= 2;
+    }
+    if (refSamps != REFERENCE_SAMPS_PER_BIT) {
+      printf("%d bits: reference has %lu samples per bit, only fewer are tested\n",
+             pn_bit_len, refSamps);
+    }
+    compute_pn_response(refMethod, mod_freq, pn_bit_len, refSamps,
+                        pn_bits, numPixels, frequencies, reference);
+
+    double refMax = 0.0;
+    for (k = 0; k < numPixels; k++) {
+      refMax = fmax(refMax, fabs(reference[k]));
+    }
+
+    for (j = 0; j < G_N_ELEMENTS(test_samps_per_bit); j++) {
+      unsigned long int samps = test_samps_per_bit[j];
+      gint64 elapsed;
+
+      if (samps >= refSamps) {
+        break; // Nothing to compare against
+      }
+
+      // First run makes any FFTW plans, only time the second
+      for (k = 0; k < numPixels; k++) {
+        pn_interp[k] = 0.0;
+      }
+      compute_pn_response(method, mod_freq, pn_bit_len, samps, pn_bits,
+                          numPixels, frequencies, pn_interp);
+      elapsed = compute_pn_response(method, mod_freq, pn_bit_len, samps, pn_bits,
+                                    numPixels, frequencies, pn_interp);
+
+      double maxDev = 0.0, sumSq = 0.0, dev;
+      for (k = 0; k < numPixels; k++) {
+        dev = fabs((double )pn_interp[k] - reference[k]);
+        maxDev = fmax(maxDev, dev);
+        sumSq += dev*dev;
+      }
+
+      printf("%8d %10lu %12.3e %12.3e %10.3f %16.1f\n", pn_bit_len, samps,
+             maxDev / refMax, sqrt(sumSq / (double )numPixels) / refMax,
+             (double )elapsed / 1000.0,
+             (double )pn_method_memory(method, pn_bit_len, samps) / 1024.0);
+    }
+    printf("\n");
+    g_free(pn_bits);
+  }
+
+#ifdef __linux__
+  // The estimates above can't be measured one at a time (the peak only ever
+  // goes up), but the peak for the whole run shows if they're far off
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    printf("Peak resident memory for the whole run: %ld kB\n", usage.ru_maxrss);
+  }
+#endif
+
+  fft_plans_shutdown();
+  g_free(frequencies);
+  g_free(reference);
+  g_free(pn_interp);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Single place to get the bits of a PN code of a given length. Codes up to
+// 1024 bits come from the tables in pn_code.h, longer ones would make for an
+// enormous header so they are generated here when needed, using the same
+// LFSR method as generators/pn_code_generator.c.
+
+#include <gtk/gtk.h>
+
+#include "pn_sequence.h"
+#include "pn_code.h"
+
+// Characteristic polynomials for maximal length LFSRs, in the same form as
+// pn_code_generator.c (the +1 term is dropped)
+struct pnPolynomial {
+  int pn_bit_len;
+  int poly;
+};
+
+static const struct pnPolynomial long_code_polys[] = {
+  {2048, 0x500}, // x^11 + x^9 + 1
+  {4096, 0xE08}, // x^12 + x^11 + x^10 + x^4 + 1
+  {8192, 0x1C80}, // x^13 + x^12 + x^11 + x^8 + 1
+  {16384, 0x3802}, // x^14 + x^13 + x^12 + x^2 + 1
+  {32768, 0x6000}, // x^15 + x^14 + 1
+  {65536, 0xD008} // x^16 + x^15 + x^13 + x^4 + 1
+};
+
+// Same as lfsr_loop in pn_code_generator.c, output[0] must hold the seed bit
+// and output must have room for the whole period plus one
+void pn_lfsr_loop(int output[], int poly)
+{
+  int a = output[0];
+  int i;
+
+  for (i = 1;; i++) {
+    int lsb = a & 1; // This is our output
+    a = (a >> 1);
+    if (lsb == 1) {
+      a ^= poly;
+    }
+
+    output[i] = lsb;
+    if (a == output[0]) {
+      break;
+    }
+  }
+}
+
+void copy_pn_table(int output[], const int table[], int pn_bit_len)
+{
+  int i;
+  for (i = 0; i < pn_bit_len; i++) {
+    output[i] = table[i];
+  }
+}
+
+int *get_pn_bits(int pn_bit_len)
+{
+  int i;
+  int *bits;
+
+  if (pn_bit_len <= 0 || pn_bit_len > MAX_PN_BIT_LEN) {
+    return NULL;
+  }
+  bits = g_malloc0(sizeof(*bits) * pn_bit_len);
+
+  switch (pn_bit_len) {
+    case 32: copy_pn_table(bits, pn_32_bit, pn_bit_len); return bits;
+    case 64: copy_pn_table(bits, pn_64_bit, pn_bit_len); return bits;
+    case 128: copy_pn_table(bits, pn_128_bit, pn_bit_len); return bits;
+    case 256: copy_pn_table(bits, pn_256_bit, pn_bit_len); return bits;
+    case 512: copy_pn_table(bits, pn_512_bit, pn_bit_len); return bits;
+    case 1024: copy_pn_table(bits, pn_1024_bit, pn_bit_len); return bits;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(long_code_polys); i++) {
+    if (long_code_polys[i].pn_bit_len == pn_bit_len) {
+      bits[0] = 0x1 & 1; // Same seed as pn_code_generator.c
+      pn_lfsr_loop(bits, long_code_polys[i].poly);
+      return bits;
+    }
+  }
+
+  g_free(bits); // Not a length we have a polynomial for
+  return NULL;
+}
@@ -0,0 +1,247 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+// Check that single precision processing is close enough to double. Takes
+// spectra through the same corrections as a scan (electric dark and
+// nonlinearity) and computes the PN response with each method, then either
+// writes the results out or compares them with results written by a build in
+// the other precision. CMake builds it both ways and ctest runs the float one
+// with --write and the double one with --compare.
+//
+// Usage: precision_check --write|--compare RESULTS [raw spectrum files...]
+// The spectra are _raw files from a scan, all on the same axis, each one a
+// repetition. Without any, synthetic spectra close to ours (18 bit counts on
+// the pn_report axis) are used.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gtk/gtk.h>
+
+#include "fft_functions.h"
+#include "measurement_params.h"
+#include "pn_precompute.h"
+#include "spectrometer_functions.h"
+
+// Relative to the largest value of each result. The corrections are within
+// about 1e-7, the PN response moves by up to 1e-5 as the frequency axis is
+// rounded to float as well.
+#define PRECISION_TOLERANCE 1e-4
+#define SYNTHETIC_REPS 20
+#define SYNTHETIC_PIXELS 1044
+#define CHECK_DARK_PIXELS 4 // The first few pixels stand in for the dark pixels
+
+// Nonlinearity coefficients of the size a QE-Pro calibration has
+static const double check_nl_coeffs[] = {0.93, 4.5e-7, -3.2e-12, 1.1e-17, -1.5e-23};
+
+// Read the x,y lines of a spectrum written by write_spectrum, returns how many
+// there were (0 if the file can't be read)
+int read_spectrum_file(const char *path,
+                       int maxPixels,
+                       double wavenumbers[],
+                       double counts[])
+{
+  char line[256];
+  int n = 0;
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+  while (n < maxPixels && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%lf,%lf", &wavenumbers[n], &counts[n]) == 2) {
+      n++;
+    } // Anything else is part of the header
+  }
+  fclose(file);
+  return n;
+}
+
+// Peaks on a sloping background with a little noise, the same in both
+// precisions
+void synthetic_spectrum(int rep,
+                        int numPixels,
+                        double counts[])
+{
+  static const double peaks[][3] = { // pixel, height (counts), width (pixels)
+    {120.0, 1.8e5, 4.0}, {410.0, 6.0e4, 2.5}, {655.0, 2.4e5, 6.0}, {902.0, 3.0e4, 3.0}
+  };
+  int i, j;
+  GRand *rand = g_rand_new_with_seed(rep + 1);
+  for (i = 0; i < numPixels; i++) {
+    double value = 1500.0 + 800.0 * (double )i / (double )numPixels;
+    for (j = 0; j < G_N_ELEMENTS(peaks); j++) {
+      double x = ((double )i - peaks[j][0]) / peaks[j][2];
+      value += peaks[j][1] / (1.0 + x*x);
+    }
+    counts[i] = floor(value + g_rand_double_range(rand, -30.0, 30.0));
+  }
+  g_rand_free(rand);
+}
+
+// Write out or compare one result, returns 1 if it's out of tolerance
+int check_result(FILE *results,
+                 int compare,
+                 const char *name,
+                 int count,
+                 const spec_real values[])
+{
+  int i;
+  if (!compare) {
+    for (i = 0; i < count; i++) {
+      fprintf(results, "%.9g\n", (double )values[i]);
+    }
+    return 0;
+  }
+
+  double other, maxValue = 0.0, maxDev = 0.0, sumSq = 0.0;
+  for (i = 0; i < count; i++) {
+    if (fscanf(results, "%lf", &other) != 1) {
+      printf("%-24s missing from the results file\n", name);
+      return 1;
+    }
+    maxValue = fmax(maxValue, fabs((double )values[i]));
+    maxDev = fmax(maxDev, fabs(other - values[i]));
+    sumSq += (other - values[i]) * (other - values[i]);
+  }
+  if (maxValue > 0.0) {
+    maxDev /= maxValue;
+    sumSq /= maxValue * maxValue;
+  }
+  int failed = !(maxDev <= PRECISION_TOLERANCE);
+  printf("%-24s %12.3e %12.3e%s\n", name, maxDev, sqrt(sumSq / (double )count),
+         failed ? "  FAILED" : "");
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  int i, rep;
+  int failures = 0;
+
+  if (argc < 3 || (strcmp(argv[1], "--write") != 0 && strcmp(argv[1], "--compare") != 0)) {
+    fprintf(stderr, "Usage: %s --write|--compare RESULTS [raw spectrum files...]\n", argv[0]);
+    return 1;
+  }
+  int compare = (strcmp(argv[1], "--compare") == 0);
+  int numFiles = argc - 3;
+  int reps = (numFiles > 0) ? numFiles : SYNTHETIC_REPS;
+
+  // The axis and counts, before they're rounded to spec_real
+  int numPixels = (numFiles > 0) ? 0 : SYNTHETIC_PIXELS;
+  int maxPixels = (numFiles > 0) ? 16384 : SYNTHETIC_PIXELS;
+  double *wavenumbers = g_malloc0(sizeof(*wavenumbers) * maxPixels);
+  double *counts = g_malloc0(sizeof(*counts) * maxPixels);
+
+  if (numFiles > 0) {
+    numPixels = read_spectrum_file(argv[3], maxPixels, wavenumbers, counts);
+    if (numPixels <= CHECK_DARK_PIXELS) {
+      fprintf(stderr, "No spectrum in %s\n", argv[3]);
+      return 1;
+    }
+  } else {
+    // Same axis as pn_report
+    for (i = 0; i < numPixels; i++) {
+      double wavelength = 640.0 + 150.0 * (double )i / (double )(numPixels - 1);
+      wavenumbers[i] = 1.0e7*((1.0 / LASER_WAVELENGTH) - (1.0 / wavelength));
+    }
+  }
+
+  FILE *results = fopen(argv[2], compare ? "r" : "w");
+  if (results == NULL) {
+    fprintf(stderr, "Unable to open %s\n", argv[2]);
+    return 1;
+  }
+
+  // A spectrometer that's only used for its corrections
+  struct spectrometer spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.numPixels = numPixels;
+  spec.dark_pixel_count = CHECK_DARK_PIXELS;
+  for (i = 0; i < CHECK_DARK_PIXELS; i++) {
+    spec.dark_pixels[i] = i;
+  }
+  spec.num_nl_coeffs = G_N_ELEMENTS(check_nl_coeffs);
+  for (i = 0; i < spec.num_nl_coeffs; i++) {
+    spec.nl_coeffs[i] = check_nl_coeffs[i];
+  }
+  struct darkHistory dark;
+  dark_history_reset(&dark);
+
+  spec_real *frequencies = g_malloc0(sizeof(*frequencies) * numPixels);
+  spec_real *values = g_malloc0(sizeof(*values) * numPixels);
+  for (i = 0; i < numPixels; i++) {
+    frequencies[i] = wavenumbers[i];
+  }
+
+  printf("%s precision, %d spectra of %d pixels\n",
+         (sizeof(spec_real) == sizeof(float)) ? "Single" : "Double", reps, numPixels);
+  if (compare) {
+    printf("%-24s %12s %12s\n", "", "max dev", "rms dev");
+  }
+
+  // The corrections, which carry the dark baseline from one spectrum to the next
+  for (rep = 0; rep < reps; rep++) {
+    if (numFiles > 0 && rep > 0 &&
+        read_spectrum_file(argv[3 + rep], maxPixels, wavenumbers, counts) != numPixels) {
+      fprintf(stderr, "%s isn't on the same axis as %s\n", argv[3 + rep], argv[3]);
+      return 1;
+    } else if (numFiles == 0) {
+      synthetic_spectrum(rep, numPixels, counts);
+    }
+    for (i = 0; i < numPixels; i++) {
+      values[i] = counts[i];
+    }
+    do_edark_correction(&spec, &dark, values, 0, numPixels);
+    do_nonlinearity_correction(&spec, values, 0, numPixels);
+
+    gchar *name = g_strdup_printf("corrected %d", rep);
+    failures += check_result(results, compare, name, numPixels, values);
+    g_free(name);
+  }
+
+  // And the PN response each way it can be worked out
+  const char *methodNames[] = {"PN_FFT_OVERSAMPLED", "PN_FFT_ANALYTIC", "PN_FFT_DIRECT"};
+  struct pnCacheKey key;
+  memset(&key, 0, sizeof(key));
+  key.pn_bit_len = pn_code_lengths[2];
+  key.mod_freq = mod_freqs[1];
+  key.numPixels = numPixels;
+  key.samps_per_bit = PN_SAMPS_PER_BIT;
+  fft_plans_init(NULL);
+  for (key.method = PN_FFT_OVERSAMPLED; key.method <= PN_FFT_DIRECT; key.method++) {
+    if (pn_response_compute(&key, frequencies, values) < 0) {
+      printf("%-24s couldn't be computed\n", methodNames[key.method]);
+      failures++;
+      continue;
+    }
+    failures += check_result(results, compare, methodNames[key.method], numPixels,
+                             values);
+  }
+  fft_plans_shutdown();
+  clear_pn_fft_cache();
+
+  fclose(results);
+  g_free(wavenumbers);
+  g_free(counts);
+  g_free(frequencies);
+  g_free(values);
+
+  if (failures > 0) {
+    printf("%d result(s) differ by more than %.0e\n", failures, PRECISION_TOLERANCE);
+    return 1;
+  }
+  return 0;
+}
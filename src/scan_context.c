@@ -0,0 +1,295 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Per scan buffers and output file names. The scan itself and all of its own
+// buffers come from one aligned block, sized up front. The PN response and
+// axis belong to the session, as later scans reuse them. The repetitions
+// still allocate inside stdio and GLib (each file opened, g_print), so the
+// heap in use is measured over them where the C library allows it.
+
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <gtk/gtk.h>
+
+#include "scan_context.h"
+#include "data_output.h"
+#include "measurement_params.h"
+
+#define REP_SUFFIX_LEN 16 // Room for a repetition number and ".txt"
+
+// First line of every file, integrated for ... is only known after auto exposure
+#define HEADER_FORMAT "Data modulated at %d MHz with a PN code length of %d, and integrated for %d msec%s\n"
+
+// Bytes a buffer of size takes up in the arena, including its alignment
+gsize arena_space(gsize size)
+{
+  return (size + SCAN_ARENA_ALIGN - 1) & ~(gsize )(SCAN_ARENA_ALIGN - 1);
+}
+
+// Bytes of heap in use (malloc'd and mmap'd) by the whole process, or -1
+// where the C library doesn't say. Only glibc 2.33 and later have mallinfo2.
+gint64 heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+  return (gint64 )(info.uordblks + info.hblkhd);
+#else
+  return -1;
+#endif
+}
+
+// Hand out the next size bytes of the arena (already zeroed)
+void *scan_alloc(struct scanContext *scan, gsize size)
+{
+  if (scan->arena_used + arena_space(size) > scan->arena_size) {
+    g_print("Scan arena is too small for another %" G_GSIZE_FORMAT " bytes\n", size);
+    return NULL;
+  }
+
+  void *buf = scan->arena + scan->arena_used;
+  scan->arena_used += arena_space(size);
+  scan->arena_allocs++;
+  return buf;
+}
+
+// Copy a string into the arena
+gchar *scan_strdup(struct scanContext *scan, const gchar *str)
+{
+  gchar *copy = scan_alloc(scan, strlen(str) + 1);
+  strcpy(copy, str);
+  return copy;
+}
+
+// The files for a scan go to data_dir/fname (data_dir is a URI), followed by
+// a suffix. Returns the local path for those that have been requested.
+gchar *output_path(const struct dataOutputOpts *outputPtr,
+                   const gchar *suffix)
+{
+  gchar *fullURI = g_strjoin(NULL, outputPtr->data_dir, "/", outputPtr->fname,
+                             suffix, NULL);
+  gchar *fullPath = g_filename_from_uri(fullURI, NULL, NULL);
+  g_free(fullURI);
+  return fullPath;
+}
+
+// Pixels whose Raman shift is in the SNR band from params (the whole
+// spectrum if none are)
+void find_snr_band(struct scanContext *scan)
+{
+  int i;
+  double low = scan->params->snr_band_low;
+  double high = scan->params->snr_band_high;
+  scan->snr_first = scan->numPixels;
+  scan->snr_last = 0;
+  for (i = 0; i < scan->numPixels; i++) {
+    if (scan->frequencies[i] >= low && scan->frequencies[i] <= high) {
+      scan->snr_first = MIN(scan->snr_first, i);
+      scan->snr_last = i + 1;
+    }
+  }
+  if (scan->snr_last <= scan->snr_first) {
+    g_print("No pixels between %.0f and %.0f cm^-1, using the whole spectrum for SNR\n",
+            low, high);
+    scan->snr_first = 0;
+    scan->snr_last = scan->numPixels;
+  }
+}
+
+// Pixels with Raman shifts from low to high, as first and count (the whole
+// spectrum if high is 0 or no pixels are in it)
+void find_roi(int numPixels, const spec_real frequencies[],
+              double low, double high, int *first, int *count)
+{
+  int i, last = 0;
+  *first = numPixels;
+  if (high > 0.0) {
+    for (i = 0; i < numPixels; i++) {
+      if (frequencies[i] >= low && frequencies[i] <= high) {
+        *first = MIN(*first, i);
+        last = i + 1;
+      }
+    }
+    if (last <= *first) {
+      g_print("No pixels between %.0f and %.0f cm^-1, keeping the whole spectrum\n",
+              low, high);
+    }
+  }
+  if (last <= *first) {
+    *first = 0;
+    last = numPixels;
+  } else {
+    g_print("Keeping pixels %d to %d (%.0f to %.0f cm^-1)\n", *first, last - 1,
+            low, high);
+  }
+  *count = last - *first;
+}
+
+// The spectrometer's axis comes from the session, which has to stay
+// on it until the scan is freed
+struct scanContext *scan_context_new(struct acqSession *session,
+                                     struct dataAcqParams *params)
+{
+  struct scanContext *scan;
+  int numPixels = params->roi_count;
+  int roi_first = params->roi_first;
+  struct dataOutputOpts *outputPtr = params->outputPtr;
+  gsize pixels = (gsize )numPixels; // Only the region of interest
+  gsize spectrumPixels = (gsize )session->numPixels;
+
+  // Work out the strings first, so we know how much room they need (the
+  // header with the longest integration time there could be):
+  gchar *header = g_strdup_printf(HEADER_FORMAT, params->mod_freq,
+                                  params->pn_bit_length, G_MAXINT,
+                                  (params->auto_exposure) ? " (chosen by auto exposure)" : "");
+  gchar *raw_prefix = output_path(outputPtr, "_raw_");
+  gchar *final_prefix = output_path(outputPtr, "_final_");
+  gchar *pn_fft_path = output_path(outputPtr, "_pn_fft.txt");
+  gchar *coadd_path = output_path(outputPtr, "_coadd.txt");
+  gchar *summary_path = output_path(outputPtr, "_summary.txt");
+  gchar *timestamps_path = output_path(outputPtr, "_timestamps.txt");
+  gchar *stream_prefix = output_path(outputPtr, "_stream_");
+  int need_stats = outputPtr->coadd || params->target_snr > 0.0;
+  gsize coadd_pixels = (need_stats) ? pixels : 0;
+  gsize longest = 0;
+  if (raw_prefix) {
+    longest = MAX(longest, strlen(raw_prefix));
+  }
+  if (final_prefix) {
+    longest = MAX(longest, strlen(final_prefix));
+  }
+  if (pn_fft_path) {
+    longest = MAX(longest, strlen(pn_fft_path));
+  }
+  if (stream_prefix) {
+    longest = MAX(longest, strlen(stream_prefix));
+  }
+
+  gsize arena_size =
+    arena_space((params->auto_exposure) ? spectrumPixels * sizeof(spec_real) : 0) +
+    arena_space(spectrumPixels * SPECTRUM_RING_SLOTS * sizeof(spec_real)) +
+    arena_space(SPECTRUM_RING_SLOTS * sizeof(int)) +
+    arena_space(SPECTRUM_RING_SLOTS * sizeof(gint64)) +
+    2 * arena_space(coadd_pixels * sizeof(double)) +
+    arena_space(strlen(header) + 1) +
+    arena_space((raw_prefix) ? strlen(raw_prefix) + 1 : 0) +
+    arena_space((final_prefix) ? strlen(final_prefix) + 1 : 0) +
+    arena_space((pn_fft_path) ? strlen(pn_fft_path) + 1 : 0) +
+    arena_space((coadd_path) ? strlen(coadd_path) + 1 : 0) +
+    arena_space((summary_path) ? strlen(summary_path) + 1 : 0) +
+    arena_space((timestamps_path) ? strlen(timestamps_path) + 1 : 0) +
+    arena_space((stream_prefix) ? strlen(stream_prefix) + 1 : 0) +
+    arena_space(longest + REP_SUFFIX_LEN);
+
+  // The scan goes at the start of the block, its buffers after it
+  guint8 *block = g_malloc0(arena_space(sizeof(*scan)) + arena_size +
+                            SCAN_ARENA_ALIGN - 1);
+  scan = (struct scanContext *)(((guintptr )block + SCAN_ARENA_ALIGN - 1) &
+                                ~(guintptr )(SCAN_ARENA_ALIGN - 1));
+  scan->arena_block = block;
+  scan->arena = (guint8 *)scan + arena_space(sizeof(*scan));
+  scan->arena_size = arena_size;
+
+  scan->numPixels = numPixels;
+  scan->roi_first = roi_first;
+  scan->spectrumPixels = session->numPixels;
+  scan->params = params;
+  stage_timings_reset(&scan->timing);
+  scan->spectrometer = session->spectrometer;
+  dark_history_reset(&scan->dark); // Nothing from the last scan
+  cadence_reset(&scan->cadence);
+  scan->frequencies = session->frequencies + roi_first;
+  if (params->auto_exposure) {
+    scan->probe = scan_alloc(scan, spectrumPixels * sizeof(spec_real));
+  }
+  spec_real *slots = scan_alloc(scan, spectrumPixels * SPECTRUM_RING_SLOTS * sizeof(spec_real));
+  int *iterations = scan_alloc(scan, SPECTRUM_RING_SLOTS * sizeof(int));
+  gint64 *timestamps = scan_alloc(scan, SPECTRUM_RING_SLOTS * sizeof(gint64));
+  spectrum_ring_init(&scan->ring, SPECTRUM_RING_SLOTS, scan->spectrumPixels, slots,
+                     iterations, timestamps);
+  if (need_stats) {
+    double *mean = scan_alloc(scan, pixels * sizeof(double));
+    double *m2 = scan_alloc(scan, pixels * sizeof(double));
+    coadd_init(&scan->coadd, numPixels, mean, m2);
+  }
+
+  find_snr_band(scan);
+
+  scan->header_len = strlen(header) + 1;
+  scan->header = scan_alloc(scan, scan->header_len);
+  scan_context_set_header(scan);
+  scan->raw_prefix = (raw_prefix) ? scan_strdup(scan, raw_prefix) : NULL;
+  scan->final_prefix = (final_prefix) ? scan_strdup(scan, final_prefix) : NULL;
+  scan->pn_fft_path = (pn_fft_path) ? scan_strdup(scan, pn_fft_path) : NULL;
+  scan->coadd_path = (coadd_path) ? scan_strdup(scan, coadd_path) : NULL;
+  scan->summary_path = (summary_path) ? scan_strdup(scan, summary_path) : NULL;
+  scan->timestamps_path = (timestamps_path) ? scan_strdup(scan, timestamps_path) : NULL;
+  scan->stream_prefix = (stream_prefix) ? scan_strdup(scan, stream_prefix) : NULL;
+  scan->path_buf_len = longest + REP_SUFFIX_LEN;
+  scan->path_buf = scan_alloc(scan, scan->path_buf_len);
+
+  g_print("Saving data to %s*\n", (raw_prefix) ? raw_prefix : "(invalid folder)");
+  g_free(header);
+  g_free(raw_prefix);
+  g_free(final_prefix);
+  g_free(pn_fft_path);
+  g_free(coadd_path);
+  g_free(summary_path);
+  g_free(timestamps_path);
+  g_free(stream_prefix);
+  return scan;
+}
+
+// Write the header again, once params->integrationTime is final
+void scan_context_set_header(struct scanContext *scan)
+{
+  struct dataAcqParams *params = scan->params;
+  g_snprintf(scan->header, scan->header_len, HEADER_FORMAT, params->mod_freq,
+             params->pn_bit_length, params->integrationTime,
+             (params->auto_exposure) ? " (chosen by auto exposure)" : "");
+}
+
+// Call once every buffer has been handed out, just before the repetitions
+// start. Notes how much heap is in use, for scan_heap_report().
+void scan_context_seal(struct scanContext *scan)
+{
+  scan->heap_before = heap_in_use();
+}
+
+// How much the heap in use grew (or shrank) from scan_context_seal() to now,
+// for the summary. Call once both threads are done with the repetitions.
+// This is growth, allocations freed again in between (e.g. by fclose) don't
+// show up.
+gchar *scan_heap_report(const struct scanContext *scan)
+{
+  gint64 after = heap_in_use();
+  if (scan->heap_before < 0 || after < 0) {
+    return g_strdup("Heap use over the repetitions isn't measured on this system\n");
+  }
+  return g_strdup_printf(
+    "Heap in use changed by %+" G_GINT64_FORMAT " bytes over the repetitions "
+    "(%" G_GINT64_FORMAT " before, %" G_GINT64_FORMAT " after)\n",
+    after - scan->heap_before, scan->heap_before, after);
+}
+
+void scan_context_free(struct scanContext *scan)
+{
+  g_print("Scan used %d buffers from a %" G_GSIZE_FORMAT " byte arena\n",
+          scan->arena_allocs, scan->arena_size);
+
+  spectrum_ring_clear(&scan->ring);
+  g_free(scan->arena_block); // The scan is in it too
+}
@@ -21,32 +21,17 @@
 #include "gtk/gtk.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "api/seabreezeapi/SeaBreezeAPI.h"
 
 #include "spectrometer_functions.h"
 
-// So we don't need to keep passing all of this around, make it static
-static long currentSpecId = 0;
-static long currentDeviceId = 0;
-static long currentBufferId = 0;
-static int numPixels = 0;
-
-// These values are for electronic dark and nonlinearity correction:
-#define MAX_DARK_PIXELS 32
-#define DARK_PIXEL_BUF_SIZE 40 // Number of recent dark pixel results to store / average
-#define MAX_NL_COEFFS 10
-static int dark_pixel_count = 0;
-static int dark_pixels[MAX_DARK_PIXELS];
-static int dark_pixel_buf_pos = 0;
-static int dark_pixel_buf_full = 0;
-static double dark_pixel_ring_buf[DARK_PIXEL_BUF_SIZE] = {0.0};
-static int num_nl_coeffs = 0;
-static double nl_coeffs[MAX_NL_COEFFS] = {0.0};
-
-void set_nl_coeff_data();
-void set_edark_pixel_data();
-void do_edark_correction(double values[]);
-void do_nonlinearity_correction(double values[]);
+// Everything about an open spectrometer is in its struct spectrometer, and
+// the dark pixel history in the caller's struct darkHistory, so nothing here
+// is shared between devices or scans.
+
+void set_nl_coeff_data(struct spectrometer *spec);
+void set_edark_pixel_data(struct spectrometer *spec);
 
 //===========================================
 // Public functions
@@ -63,52 +48,66 @@ void shutdown_spectrometer_api()
   return;
 }
 
-// Sets globals currentDeviceId and currentSpecId (assuming only 1 spectrometer)
-// Opens the spectrometer
-void open_spectrometer(long spectrometerId)
+// Opens the spectrometer and reads what we need from it (assuming it only has
+// one spectrometer feature and one data buffer). close_spectrometer() when done.
+struct spectrometer *open_spectrometer(long spectrometerId)
 {
-  if (spectrometerId != currentDeviceId) { // only if this is a new spectrometer
-    int error = 0;
-    if (currentDeviceId != 0) { // close the previous one if this isn't initial startup
-      close_spectrometer();
-    }
-  g_print("Opening device...\n");
-    int numSpecs;
-    long *specList;
-    currentDeviceId = spectrometerId;
-    sbapi_open_device(currentDeviceId, &error);
-
-    numSpecs = sbapi_get_number_of_spectrometer_features(currentDeviceId, &error);
-    specList = g_malloc0(numSpecs * sizeof(specList));
-    numSpecs = sbapi_get_spectrometer_features(currentDeviceId, &error,
-            specList, numSpecs);
-    currentSpecId = specList[0]; // WE ARE ASSUMING ONLY ONE HERE!!!!!
-
-    // We also assume only one data buffer:
-    int number_of_data_buffers;
-    long *data_buffer_ids;
-    number_of_data_buffers = sbapi_get_number_of_data_buffer_features(currentDeviceId, &error);
-
-    data_buffer_ids = g_malloc0(number_of_data_buffers*sizeof(data_buffer_ids));
-    number_of_data_buffers = sbapi_get_data_buffer_features(currentDeviceId, &error,
-            data_buffer_ids, number_of_data_buffers);
-    currentBufferId = data_buffer_ids[0];
-
-    set_edark_pixel_data();
-    set_nl_coeff_data();
-    g_free(specList);
-    g_free(data_buffer_ids);
+  struct spectrometer *spec = g_malloc0(sizeof(*spec));
+  int error = 0;
+g_print("Opening device...\n");
+  int numSpecs;
+  long *specList;
+  spec->deviceId = spectrometerId;
+  sbapi_open_device(spec->deviceId, &error);
+
+  numSpecs = sbapi_get_number_of_spectrometer_features(spec->deviceId, &error);
+  specList = g_malloc0(numSpecs * sizeof(specList));
+  numSpecs = sbapi_get_spectrometer_features(spec->deviceId, &error,
+          specList, numSpecs);
+  spec->specId = specList[0]; // WE ARE ASSUMING ONLY ONE HERE!!!!!
+
+  // We also assume only one data buffer:
+  int number_of_data_buffers;
+  long *data_buffer_ids;
+  number_of_data_buffers = sbapi_get_number_of_data_buffer_features(spec->deviceId, &error);
+
+  data_buffer_ids = g_malloc0(number_of_data_buffers*sizeof(data_buffer_ids));
+  number_of_data_buffers = sbapi_get_data_buffer_features(spec->deviceId, &error,
+          data_buffer_ids, number_of_data_buffers);
+  spec->bufferId = data_buffer_ids[0];
+
+  spec->numPixels = sbapi_spectrometer_get_formatted_spectrum_length(spec->deviceId,
+                      spec->specId, &error);
+  spec->max_intensity = sbapi_spectrometer_get_maximum_intensity(spec->deviceId,
+                           spec->specId, &error);
+  spec->min_integration_us = sbapi_spectrometer_get_minimum_integration_time_micros(
+                               spec->deviceId, spec->specId, &error);
+  error = 0;
+  spec->max_integration_us = sbapi_spectrometer_get_maximum_integration_time_micros(
+                               spec->deviceId, spec->specId, &error);
+  if (error != 0 || spec->max_integration_us < 0) {
+    spec->max_integration_us = 0;
   }
+#ifdef USE_SINGLE_PRECISION
+  spec->raw_spectrum = g_malloc0(spec->numPixels * sizeof(*spec->raw_spectrum));
+#endif
 
-  return;
+  set_edark_pixel_data(spec);
+  set_nl_coeff_data(spec);
+  g_free(specList);
+  g_free(data_buffer_ids);
+
+  return spec;
 }
 
-void close_spectrometer()
+void close_spectrometer(struct spectrometer *spec)
 {
   int error = 0;
-  sbapi_close_device(currentDeviceId, &error);
-  currentDeviceId = 0;
-  currentSpecId = 0;
+  sbapi_close_device(spec->deviceId, &error);
+#ifdef USE_SINGLE_PRECISION
+  g_free(spec->raw_spectrum);
+#endif
+  g_free(spec);
   return;
 }
 
@@ -134,70 +133,130 @@ int get_spectrometer_ids(long idArr[MAX_SPECTROMETERS],
   return count;
 }
 
-int count_spectrometer_pixels()
+int count_spectrometer_pixels(const struct spectrometer *spec)
 {
-  int error = 0;
-  numPixels = sbapi_spectrometer_get_formatted_spectrum_length(currentDeviceId,
-                  currentSpecId, &error);
-  return numPixels;
+  return spec->numPixels; // Read when it was opened
 }
 
-void get_wavelengths(double wavelengths[])
+void get_wavelengths(const struct spectrometer *spec, double wavelengths[])
 {
   int error = 0;
-  sbapi_spectrometer_get_wavelengths(currentDeviceId, currentSpecId,
-                                     &error, wavelengths, numPixels);
+  sbapi_spectrometer_get_wavelengths(spec->deviceId, spec->specId,
+                                     &error, wavelengths, spec->numPixels);
   return;
 }
 
-void set_integration_time(int integrationTime) // assumed to be in ms
+void set_integration_time(struct spectrometer *spec,
+                          int integrationTime) // assumed to be in ms
 {
   int error = 0;
   // Set the integration time in us (instead of ms):
   unsigned long usTime = (unsigned long )integrationTime * 1000;
 
-  sbapi_spectrometer_set_integration_time_micros(currentDeviceId,
-        currentSpecId, &error, usTime);
+  sbapi_spectrometer_set_integration_time_micros(spec->deviceId,
+        spec->specId, &error, usTime);
 
   return;
 }
 
-void clear_spectrometer_buffer()
+void clear_spectrometer_buffer(struct spectrometer *spec)
 {
   int error = 0;
-  sbapi_data_buffer_clear(currentDeviceId, currentBufferId, &error);
+  sbapi_data_buffer_clear(spec->deviceId, spec->bufferId, &error);
 
   return;
 }
 
-int get_spectrum(double values[])
+// Raw counts straight from the spectrometer, see correct_spectrum()
+int read_spectrum(struct spectrometer *spec, spec_real values[])
 {
   int error = 0;
   int count = 0;
-  count = sbapi_spectrometer_get_formatted_spectrum(currentDeviceId,
-          currentSpecId, &error, values, numPixels);
-
-  do_edark_correction(values);
-  do_nonlinearity_correction(values);
+#ifdef USE_SINGLE_PRECISION
+  int i;
+  count = sbapi_spectrometer_get_formatted_spectrum(spec->deviceId,
+          spec->specId, &error, spec->raw_spectrum, spec->numPixels);
+  for (i = 0; i < spec->numPixels; i++) {
+    values[i] = (spec_real )spec->raw_spectrum[i];
+  }
+#else
+  count = sbapi_spectrometer_get_formatted_spectrum(spec->deviceId,
+          spec->specId, &error, values, spec->numPixels);
+#endif
   return count; // Return actual number of pixels in spectrum, though this is unused
 }
 
+// Spectra have to be corrected in the order they were read, as the electric
+// dark baseline is averaged over the most recent ones
+void correct_spectrum(const struct spectrometer *spec,
+                      struct darkHistory *history,
+                      spec_real values[])
+{
+  do_edark_correction(spec, history, values, 0, spec->numPixels);
+  do_nonlinearity_correction(spec, values, 0, spec->numPixels);
+}
+
+int get_spectrum(struct spectrometer *spec,
+                 struct darkHistory *history,
+                 spec_real values[])
+{
+  int count = read_spectrum(spec, values);
+  correct_spectrum(spec, history, values);
+  return count;
+}
+
+// Burst readout: rather than clearing the buffer and waiting for a fresh
+// spectrum every time, let the spectrometer integrate back to back into its
+// on-board buffer and read the spectra out oldest first. Returns the capacity
+// actually set (the device has its own limits).
+unsigned long int start_burst_readout(struct spectrometer *spec,
+                                      unsigned long int capacity)
+{
+  int error = 0;
+  unsigned long int minCapacity, maxCapacity;
+
+  minCapacity = sbapi_data_buffer_get_buffer_capacity_minimum(spec->deviceId,
+                  spec->bufferId, &error);
+  maxCapacity = sbapi_data_buffer_get_buffer_capacity_maximum(spec->deviceId,
+                  spec->bufferId, &error);
+  capacity = CLAMP(capacity, minCapacity, maxCapacity);
+
+  sbapi_data_buffer_set_buffer_capacity(spec->deviceId, spec->bufferId,
+                                        &error, capacity);
+  // Only spectra from now on:
+  sbapi_data_buffer_clear(spec->deviceId, spec->bufferId, &error);
+
+  return sbapi_data_buffer_get_buffer_capacity(spec->deviceId, spec->bufferId,
+                                               &error);
+}
+
+// Number of spectra waiting in the on-board buffer, -1 if it can't be read
+int count_buffered_spectra(struct spectrometer *spec)
+{
+  int error = 0;
+  unsigned long int count;
+  count = sbapi_data_buffer_get_number_of_elements(spec->deviceId,
+            spec->bufferId, &error);
+  return (error == 0) ? (int )count : -1;
+}
+
 
 //========================================================
 // Private functions used only inside this file
 
-void set_edark_pixel_data()
+void set_edark_pixel_data(struct spectrometer *spec)
 {
   int error = 0;
   // Get number of dark pixels
-  dark_pixel_count = sbapi_spectrometer_get_electric_dark_pixel_count(currentDeviceId,
-      currentSpecId, &error);
+  spec->dark_pixel_count = sbapi_spectrometer_get_electric_dark_pixel_count(spec->deviceId,
+      spec->specId, &error);
+  spec->dark_pixel_count = MIN(spec->dark_pixel_count, MAX_DARK_PIXELS);
   // Fill dark_pixels with the indices of the dark pixels
-  dark_pixel_count = sbapi_spectrometer_get_electric_dark_pixel_indices(currentDeviceId,
-          currentSpecId, &error, dark_pixels, dark_pixel_count);
+  spec->dark_pixel_count = sbapi_spectrometer_get_electric_dark_pixel_indices(spec->deviceId,
+          spec->specId, &error, spec->dark_pixels, spec->dark_pixel_count);
 }
 
-void set_nl_coeff_data()
+void set_nl_coeff_data(struct spectrometer *spec)
 {
   int error = 0;
   int num_nl_features;
@@ -205,50 +264,65 @@ void set_nl_coeff_data()
 
   // Find how many detectors support NL correction (WE ASSUME 1!!!)
   num_nl_features = sbapi_get_number_of_nonlinearity_coeffs_features
-                                (currentDeviceId, &error);
+                                (spec->deviceId, &error);
   nl_feature_ids = g_malloc0(num_nl_features*sizeof(nl_feature_ids));
   // Set the NL feature IDs
-  num_nl_features = sbapi_get_nonlinearity_coeffs_features(currentDeviceId,
+  num_nl_features = sbapi_get_nonlinearity_coeffs_features(spec->deviceId,
                       &error, nl_feature_ids, num_nl_features);
   // Now get the NL coefficients
-  num_nl_coeffs = sbapi_nonlinearity_coeffs_get(currentDeviceId,
-                    nl_feature_ids[0], &error, nl_coeffs, MAX_NL_COEFFS);
+  spec->num_nl_coeffs = sbapi_nonlinearity_coeffs_get(spec->deviceId,
+                    nl_feature_ids[0], &error, spec->nl_coeffs, MAX_NL_COEFFS);
   g_free(nl_feature_ids);
   return;
 }
 
-// In-Place operation on pixel intensity values to account for electronic noise
-void do_edark_correction(double values[])
+// Start a new dark pixel history, e.g. at the beginning of a scan
+void dark_history_reset(struct darkHistory *history)
+{
+  memset(history, 0, sizeof(*history));
+}
+
+// In-Place operation on pixel intensity values to account for electronic noise.
+// The baseline is averaged over the recent dark pixels in history. The dark
+// pixels are read wherever they are, only pixels first to last - 1 are
+// corrected.
+void do_edark_correction(const struct spectrometer *spec,
+                         struct darkHistory *history,
+                         spec_real values[],
+                         int first, int last)
 {
   int i, maxBufPos;
   double baseline = 0.0;
 
   // Add new values to our ring buffer:
-  for (i = 0; i < dark_pixel_count; i++) {
-    dark_pixel_ring_buf[dark_pixel_buf_pos] = values[dark_pixels[i]];
-    dark_pixel_buf_pos++;
-    if (dark_pixel_buf_pos == DARK_PIXEL_BUF_SIZE) {
+  for (i = 0; i < spec->dark_pixel_count; i++) {
+    history->values[history->pos] = values[spec->dark_pixels[i]];
+    history->pos++;
+    if (history->pos == DARK_PIXEL_BUF_SIZE) {
       // Reset our buffer and note that we have now filled it:
-      dark_pixel_buf_pos = 0;
-      dark_pixel_buf_full = 1;
+      history->pos = 0;
+      history->full = 1;
     }
   }
 
   // Average over the buffer:
-  if(dark_pixel_buf_full == 1) {
+  if(history->full == 1) {
     maxBufPos = DARK_PIXEL_BUF_SIZE;
   } else {
-    maxBufPos = dark_pixel_buf_pos;
+    maxBufPos = history->pos;
+  }
+  if (maxBufPos == 0) {
+    return; // No dark pixels on this spectrometer
   }
   // Build the baseline:
   for (i = 0; i < maxBufPos; i++) {
-    baseline += dark_pixel_ring_buf[i];
+    baseline += history->values[i];
   }
 
   baseline /= (double )maxBufPos; // average
 
   // Now correct our values:
-  for (i = 0; i < numPixels; i++) {
+  for (i = first; i < last; i++) {
     values[i] -= baseline;
   }
 
@@ -257,18 +331,20 @@ void do_edark_correction(double values[])
 
 
 // In-place nonlinearity correction for the pixel values
-void do_nonlinearity_correction(double values[])
+void do_nonlinearity_correction(const struct spectrometer *spec,
+                                spec_real values[],
+                                int first, int last)
 {
   int i,j;
   double xpower,y;
 
-  for (i = 0; i < numPixels; i++) {
+  for (i = first; i < last; i++) {
     // N-th order polynomial correction based on how many terms we have:
     xpower = values[i];
-    y = nl_coeffs[0];
+    y = spec->nl_coeffs[0];
 
-    for (j = 1; j < num_nl_coeffs; j++) { // starts at 1 as we pre-load the 0 term above
-      y += xpower*nl_coeffs[j];
+    for (j = 1; j < spec->num_nl_coeffs; j++) { // starts at 1 as we pre-load the 0 term above
+      y += xpower*spec->nl_coeffs[j];
       xpower *= values[i];
     }
 
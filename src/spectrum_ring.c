@@ -0,0 +1,132 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Ring of spectrum slots so the acquisition thread can keep reading spectra
+// while another thread corrects and writes out the ones already taken.
+// head and tail only ever increase, so the slot for count n is n % numSlots and
+// head - tail is the number of full slots (unsigned, so wrapping is fine).
+
+#include <gtk/gtk.h>
+
+#include "spectrum_ring.h"
+
+// The ring doesn't allocate anything, the slots come from the caller (see
+// scan_context.c)
+void spectrum_ring_init(struct spectrumRing *ring,
+                        int numSlots,
+                        int numPixels,
+                        spec_real slots[],
+                        int iterations[],
+                        gint64 timestamps[])
+{
+  ring->numSlots = numSlots;
+  ring->numPixels = numPixels;
+  ring->slots = slots;
+  ring->iterations = iterations;
+  ring->timestamps = timestamps;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->closed = 0;
+  ring->producer_waiting = 0;
+  ring->consumer_waiting = 0;
+  g_mutex_init(&ring->lock);
+  g_cond_init(&ring->changed);
+}
+
+void spectrum_ring_clear(struct spectrumRing *ring)
+{
+  g_mutex_clear(&ring->lock);
+  g_cond_clear(&ring->changed);
+}
+
+guint ring_count(struct spectrumRing *ring)
+{
+  return (guint )g_atomic_int_get(&ring->head) - (guint )g_atomic_int_get(&ring->tail);
+}
+
+// Wake the other side, but only take the lock if it might be asleep. The
+// atomics are full barriers: either the sleeper sees our update before it
+// waits, or we see its waiting flag here.
+void ring_notify(struct spectrumRing *ring, gint *waiting)
+{
+  if (g_atomic_int_get(waiting)) {
+    g_mutex_lock(&ring->lock);
+    g_cond_broadcast(&ring->changed);
+    g_mutex_unlock(&ring->lock);
+  }
+}
+
+spec_real *spectrum_ring_begin_write(struct spectrumRing *ring)
+{
+  if (ring_count(ring) == (guint )ring->numSlots) {
+    g_mutex_lock(&ring->lock);
+    g_atomic_int_set(&ring->producer_waiting, 1);
+    while (ring_count(ring) == (guint )ring->numSlots) {
+      g_cond_wait(&ring->changed, &ring->lock);
+    }
+    g_atomic_int_set(&ring->producer_waiting, 0);
+    g_mutex_unlock(&ring->lock);
+  }
+
+  guint slot = (guint )g_atomic_int_get(&ring->head) % (guint )ring->numSlots;
+  return ring->slots + (gsize )slot * ring->numPixels;
+}
+
+void spectrum_ring_end_write(struct spectrumRing *ring, int iteration,
+                             gint64 timestamp)
+{
+  guint head = (guint )g_atomic_int_get(&ring->head);
+  ring->iterations[head % (guint )ring->numSlots] = iteration;
+  ring->timestamps[head % (guint )ring->numSlots] = timestamp;
+  g_atomic_int_set(&ring->head, (gint )(head + 1)); // Publishes the slot
+  ring_notify(ring, &ring->consumer_waiting);
+}
+
+void spectrum_ring_close(struct spectrumRing *ring)
+{
+  g_atomic_int_set(&ring->closed, 1);
+  ring_notify(ring, &ring->consumer_waiting);
+}
+
+spec_real *spectrum_ring_begin_read(struct spectrumRing *ring,
+                                    int *iteration,
+                                    gint64 *timestamp)
+{
+  if (ring_count(ring) == 0) {
+    g_mutex_lock(&ring->lock);
+    g_atomic_int_set(&ring->consumer_waiting, 1);
+    while (ring_count(ring) == 0 && !g_atomic_int_get(&ring->closed)) {
+      g_cond_wait(&ring->changed, &ring->lock);
+    }
+    g_atomic_int_set(&ring->consumer_waiting, 0);
+    g_mutex_unlock(&ring->lock);
+
+    if (ring_count(ring) == 0) {
+      return NULL; // Closed, and everything has been read
+    }
+  }
+
+  guint slot = (guint )g_atomic_int_get(&ring->tail) % (guint )ring->numSlots;
+  *iteration = ring->iterations[slot];
+  *timestamp = ring->timestamps[slot];
+  return ring->slots + (gsize )slot * ring->numPixels;
+}
+
+void spectrum_ring_end_read(struct spectrumRing *ring)
+{
+  guint tail = (guint )g_atomic_int_get(&ring->tail);
+  g_atomic_int_set(&ring->tail, (gint )(tail + 1)); // Hands the slot back
+  ring_notify(ring, &ring->producer_waiting);
+}
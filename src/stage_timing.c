@@ -0,0 +1,178 @@
+/**
+    Copyright (c) 2021 Ben Cerjan
+    This file is part of ss-Raman-GUI.
+    ss-Raman-GUI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    ss-Raman-GUI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public License
+    along with ss-Raman-GUI.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Fixed-bucket latency histograms for each stage of a scan, so we can see
+// where the time between spectra goes. Recording is a clock read and a couple
+// of integer operations, and never allocates, so it can stay on in the
+// repetition loop. Timestamps come from g_get_monotonic_time().
+
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+
+#include "stage_timing.h"
+
+static const char *stage_names[NUM_STAGES] = {
+  "open_spectrometer", "auto exposure", "PN response", "clear buffer",
+  "wait for spectrum", "read_spectrum", "edark correction", "nonlinearity", "output_data"
+};
+
+void stage_timings_reset(struct stageTimings *timings)
+{
+  memset(timings, 0, sizeof(*timings));
+}
+
+int stage_bucket(gint64 elapsed)
+{
+  if (elapsed < STAGE_SUB_BUCKETS) {
+    return (elapsed < 0) ? 0 : (int )elapsed;
+  }
+  // 3 is log2(STAGE_SUB_BUCKETS), the top bits after the leading one pick
+  // the sub bucket
+  int e = (int )g_bit_storage((gulong )elapsed) - 1;
+  int bucket = (e - 2) * STAGE_SUB_BUCKETS +
+               (int )((elapsed >> (e - 3)) - STAGE_SUB_BUCKETS);
+  return MIN(bucket, STAGE_BUCKETS - 1);
+}
+
+// Smallest time (in us) that lands in bucket
+gint64 stage_bucket_start(int bucket)
+{
+  if (bucket < STAGE_SUB_BUCKETS) {
+    return bucket;
+  }
+  int e = bucket / STAGE_SUB_BUCKETS + 2;
+  return (gint64 )(STAGE_SUB_BUCKETS + bucket % STAGE_SUB_BUCKETS) << (e - 3);
+}
+
+void stage_add(struct stageTimings *timings, int stage, gint64 elapsed)
+{
+  struct stageHistogram *hist = &timings->stages[stage];
+  hist->buckets[stage_bucket(elapsed)]++;
+  hist->count++;
+  hist->total += elapsed;
+  hist->max = MAX(hist->max, elapsed);
+}
+
+// Record the time since start (from g_get_monotonic_time())
+void stage_record(struct stageTimings *timings, int stage, gint64 start)
+{
+  stage_add(timings, stage, g_get_monotonic_time() - start);
+}
+
+// Upper edge of the bucket holding the given fraction of the samples, which
+// is never more than the real maximum
+gint64 stage_percentile(const struct stageHistogram *hist, double fraction)
+{
+  int i;
+  guint64 target = (guint64 )(fraction * (double )hist->count + 0.5);
+  guint64 seen = 0;
+
+  target = CLAMP(target, 1, hist->count);
+  for (i = 0; i < STAGE_BUCKETS - 1; i++) {
+    seen += hist->buckets[i];
+    if (seen >= target) {
+      return MIN(stage_bucket_start(i + 1) - 1, hist->max);
+    }
+  }
+  return hist->max;
+}
+
+void cadence_reset(struct cadenceStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+}
+
+// Add the spectrum acquired at timestamp (monotonic, us). An interval longer
+// than late_after counts as late.
+gint64 cadence_add(struct cadenceStats *stats, gint64 timestamp, gint64 late_after)
+{
+  gint64 interval = 0;
+
+  if (stats->last != 0) {
+    interval = timestamp - stats->last;
+    stats->count++;
+    double delta = (double )interval - stats->mean;
+    stats->mean += delta / (double )stats->count;
+    stats->m2 += delta * ((double )interval - stats->mean);
+    stats->max = MAX(stats->max, interval);
+    if (interval > late_after) {
+      stats->late++;
+    }
+  }
+  stats->last = timestamp;
+  return interval;
+}
+
+gchar *cadence_report(const struct cadenceStats *stats)
+{
+  double jitter = (stats->count > 1) ?
+                  sqrt(stats->m2 / (double )(stats->count - 1)) : 0.0;
+
+  return g_strdup_printf(
+    "Time between spectra %.3f ms on average, jitter (standard deviation) %.3f ms, "
+    "longest %.3f ms. %d took more than twice the integration time\n",
+    stats->mean / 1000.0, jitter / 1000.0, (double )stats->max / 1000.0, stats->late);
+}
+
+// Fraction of elapsed (us) the detector spent integrating for spectra
+// spectra of integrationTime (ms) each
+double duty_cycle(int spectra, int integrationTime, gint64 elapsed)
+{
+  if (elapsed <= 0) {
+    return 0.0;
+  }
+  return (double )spectra * (double )integrationTime * 1000.0 / (double )elapsed;
+}
+
+// The duty cycle of a scan that took elapsed (us) and how much of that time
+// went to each stage after the spectrometer was set up. Corrections and
+// output run on the output thread, alongside everything else, so they only
+// cost integration time if the spectrum ring fills up.
+gchar *duty_cycle_report(const struct stageTimings *timings, int spectra,
+                         int integrationTime, gint64 elapsed)
+{
+  double scale = (elapsed > 0) ? 100.0 / (double )elapsed : 0.0;
+  const struct stageHistogram *stages = timings->stages;
+
+  return g_strdup_printf(
+    "Duty cycle %.1f%% (%d spectra of %d ms in %.3f s)\n"
+    "USB transfer %.1f%%, buffer clearing %.1f%%, waiting for spectra %.1f%%, "
+    "corrections %.1f%% and output %.1f%% (output thread)\n",
+    100.0 * duty_cycle(spectra, integrationTime, elapsed), spectra,
+    integrationTime, (double )elapsed / 1.0e6,
+    scale * (double )stages[STAGE_READ_SPECTRUM].total,
+    scale * (double )stages[STAGE_CLEAR_BUFFER].total,
+    scale * (double )stages[STAGE_WAIT_SPECTRUM].total,
+    scale * (double )(stages[STAGE_EDARK].total + stages[STAGE_NONLINEARITY].total),
+    scale * (double )stages[STAGE_OUTPUT].total);
+}
+
+void stage_timings_print(const struct stageTimings *timings)
+{
+  int i;
+  g_print("%-18s %10s %10s %10s %10s %10s\n", "Stage timing (us)", "count",
+          "mean", "p50", "p99", "max");
+  for (i = 0; i < NUM_STAGES; i++) {
+    const struct stageHistogram *hist = &timings->stages[i];
+    if (hist->count == 0) {
+      continue;
+    }
+    g_print("%-18s %10" G_GUINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+            " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+            stage_names[i], hist->count, hist->total / (gint64 )hist->count,
+            stage_percentile(hist, 0.50), stage_percentile(hist, 0.99), hist->max);
+  }
+}
@@ -21,8 +21,8 @@
 #include <stdbool.h>
 #include <math.h>
 
-// Header file containing pre-defined waveform data
-#include "pn_code.h"
+// Header file for looking up the PN code
+#include "pn_sequence.h"
 
 // Header file with experimental parameters
 #include "measurement_params.h"
@@ -35,6 +35,13 @@
 static const DWORD CardNum = 1; // Fixed, we only have 1 card
 static const DWORD Chan = 1; // Fixed, our card only has one channel
 
+// The card stays open (and keeps its waveform) between scans, it's only
+// reloaded when the PN code or modulation frequency changes
+static bool card_open = false;
+static bool waveform_loaded = false;
+static int loaded_pn_bit_len = 0;
+static int loaded_mod_freq = 0;
+
 // Function to count how many waveform generators are attached
 unsigned long count_wvfm_gen()
 {
@@ -44,15 +51,26 @@ unsigned long count_wvfm_gen()
   return NumCards;
 }
 
-void start_wvfm_gen(int pn_bit_len /* Power of 2 */, int mod_freq /* MHz */)
+// Load (if needed) and start the waveform for this code, returns 0 if it's
+// running or -1 if it can't be generated
+int start_wvfm_gen(int pn_bit_len /* Power of 2 */, int mod_freq /* MHz */)
 {
   int i,j,x;
+  int requested_bit_len = pn_bit_len; // pn_bit_len changes for the test sequence
+
+  if (waveform_loaded && pn_bit_len == loaded_pn_bit_len &&
+      mod_freq == loaded_mod_freq) {
+    // Same waveform as last time, just turn it back on
+    DAx22000_Run(CardNum, true);
+    return 0;
+  }
+
   double actual_frequency, clk_rate;
   clk_rate = 2.0e9; // Set to 2 GHz clock rate. Note that mod_freq should be
                     // an even divisor of this number
   int isamps_per_bit = (int ) ceil( clk_rate / ((double) mod_freq * 1.0e6) ); // How many clock cycles long are our bits? (multiplication is to convert from MHz)
 
-  WORD wvfm_array[1024] = {0}; // Array to hold our waveform values, may need to make larger buffer if we need to alter our clock rate
+  WORD *wvfm_array; // Array to hold our waveform values, one per bit
 
   // LIKELY NEED TO ADJUST THIS OR ADD A 0 POSITION OFFSET (OR BOTH)
   WORD magnitude = WVFM_MAGNITUDE; // magnitude from "0" state to "1" state
@@ -61,40 +79,34 @@ void start_wvfm_gen(int pn_bit_len /* Power of 2 */, int mod_freq /* MHz */)
   // we can get away with setting the clock rate to be the actual user-desired
   // rate and just going from high to low (this is what is currently implemented)
 
-  // Load our waveform array from the header file here:
+  // Load our waveform array:
   if (pn_bit_len == 0) {
     // Test Sequence of alternating 0 and 1
-    for (i = 0; i < 32; i++ ) {
-      wvfm_array[i] = magnitude * (i % 2);
-    }
     pn_bit_len = 32;
-  } else if (pn_bit_len == 32) {
-    for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_32_bit[i] * magnitude;
-    }
-  } else if (pn_bit_len == 64) {
-    for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_64_bit[i] * magnitude;
-    }
-  } else if (pn_bit_len == 128) {
-    for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_128_bit[i] * magnitude;
-    }
-  } else if (pn_bit_len == 256) {
-    for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_256_bit[i] * magnitude;
+    wvfm_array = g_malloc0(sizeof(*wvfm_array) * pn_bit_len);
+    for (i = 0; i < pn_bit_len; i++ ) {
+      wvfm_array[i] = magnitude * (i % 2);
     }
-  } else if (pn_bit_len == 512) {
-    for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_512_bit[i] * magnitude;
+  } else {
+    int *pn_bits = get_pn_bits(pn_bit_len);
+    if (pn_bits == NULL) {
+      // Bad inputs
+      g_print("No PN code of length %d\n", pn_bit_len);
+      return -1;
     }
-  } else if (pn_bit_len == 1024) {
+    wvfm_array = g_malloc0(sizeof(*wvfm_array) * pn_bit_len);
     for (i = 0; i < pn_bit_len; i++) {
-      wvfm_array[i] = pn_1024_bit[i] * magnitude;
+      wvfm_array[i] = pn_bits[i] * magnitude;
     }
-  } else {
-    // Bad inputs
-    return;
+    g_free(pn_bits);
+  }
+
+  // Make sure the whole code fits in the generator's memory before we try
+  if ((guint64 )pn_bit_len * (guint64 )isamps_per_bit > WVFM_MAX_POINTS) {
+    g_print("PN code of %d bits at %d MHz needs more than %d points\n",
+            pn_bit_len, mod_freq, WVFM_MAX_POINTS);
+    g_free(wvfm_array);
+    return -1;
   }
 
   DWORD NumPoints = pn_bit_len * isamps_per_bit;// Length of our waveform before it loops
@@ -112,14 +124,19 @@ void start_wvfm_gen(int pn_bit_len /* Power of 2 */, int mod_freq /* MHz */)
       }
     }
 
-  // This seems to be necessary, or the waveform generator doesn't turn on...
-  x = DAx22000_GetNumCards();
+  if (!card_open) {
+    // This seems to be necessary, or the waveform generator doesn't turn on...
+    x = DAx22000_GetNumCards();
 
-  // Initialize the driver and controller, and set clock rate:
-  x = DAx22000_Open(CardNum);
-  x = DAx22000_Initialize(CardNum);
+    // Initialize the driver and controller, and set clock rate:
+    x = DAx22000_Open(CardNum);
+    x = DAx22000_Initialize(CardNum);
 
-  actual_frequency = DAx22000_SetClkRate(CardNum, clk_rate); // Need to convert from MHz to Hz
+    actual_frequency = DAx22000_SetClkRate(CardNum, clk_rate); // Need to convert from MHz to Hz
+    card_open = true;
+  } else {
+    DAx22000_Stop(CardNum); // Before replacing the waveform
+  }
 
   // Input our waveform:
   x = DAx22000_CreateSingleSegment(
@@ -128,24 +145,40 @@ void start_wvfm_gen(int pn_bit_len /* Power of 2 */, int mod_freq /* MHz */)
     NumPoints,
     0, // NumLoops, 0 -> continuous loop
     high_res_pn[0], // PAD_Val_Beg (0 <= value <= 4095)
-    wvfm_array[NumPoints-1], // PAD_Val_End (same ^)
+    wvfm_array[pn_bit_len-1], // PAD_Val_End (same ^)
     high_res_pn,
     1 // Trigger status, 1 lets us re-trigger later
   );
 
+  waveform_loaded = true;
+  loaded_pn_bit_len = requested_bit_len;
+  loaded_mod_freq = mod_freq;
+
   // Now turn on the generator:
   DAx22000_Run(CardNum, true);
   g_free(high_res_pn);
+  g_free(wvfm_array);
 
-  return;
+  return 0;
 }
 
+// Stop output, but leave the card set up for the next scan
 void stop_wvfm_gen() {
-  // Stop output:
-  DAx22000_Stop(CardNum);
+  if (card_open) {
+    DAx22000_Stop(CardNum);
+  }
 
-  // Close driver:
-  DAx22000_Close(CardNum);
+  return;
+}
+
+// Stop output and close the driver, for when we're done with the card
+void close_wvfm_gen() {
+  if (card_open) {
+    DAx22000_Stop(CardNum);
+    DAx22000_Close(CardNum);
+  }
+  card_open = false;
+  waveform_loaded = false;
 
   return;
 }
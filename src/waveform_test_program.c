@@ -16,14 +16,17 @@ int main()
 	int pn_bit_len = 128;
 
 	printf("Starting waveform generation, press ENTER to stop\n");
-	start_wvfm_gen(pn_bit_len, mod_freq);
+	if (start_wvfm_gen(pn_bit_len, mod_freq) < 0) {
+		close_wvfm_gen();
+		return 1;
+	}
 	fflush(stdout);
 	// Wait for keyboard interrupt
 	getchar();
 	printf("Stopped waveform generation\n");
 
 	// Then stop:
-	stop_wvfm_gen();
+	close_wvfm_gen();
 
 	return 0;
 }